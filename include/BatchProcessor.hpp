@@ -0,0 +1,65 @@
+#pragma once
+
+#include <QtCore/QHash>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QRect>
+#include <QtCore/QSize>
+#include <QtCore/Qt>
+#include "WebPHandler.hpp"
+#include "Resampler.hpp"
+
+class EditPipeline;
+
+// What a batch run does to every input. Edits are applied in this order:
+// crop (in source coordinates), rotation, flip, resize, then encoding.
+struct BatchOptions {
+    QStringList inputs;          // Files, or directories whose images are all processed
+    QString outputDirectory;
+    QString outputFormat = "webp";
+    QRect crop;                  // Invalid for no crop
+    int rotation = 0;            // Clockwise degrees, a multiple of 90
+    Qt::Orientations flip;
+    QSize size;                  // Invalid for no resize; a 0 side keeps the aspect ratio
+    ResampleFilter filter = ResampleFilter::Lanczos3;
+    WebPEncodeOptions encode;
+    int threads = 0;             // 0 uses every core
+};
+
+// Headless processing of many files at once, one file per pool thread,
+// running the same pixel code as the interactive tools
+class BatchProcessor {
+public:
+    explicit BatchProcessor(const BatchOptions& options);
+
+    // Processes every input, printing per-file timings and the aggregate
+    // throughput. Returns the number of files that failed.
+    int run();
+
+    // Entry point for "--batch": parses arguments and runs; returns the exit code
+    static int exec(const QStringList& arguments);
+
+private:
+    struct FileResult {
+        QString input;
+        QString output;
+        bool success = false;
+        QString error;
+        qint64 inputBytes = 0;
+        qint64 outputBytes = 0;
+        qint64 decodeMs = 0;
+        qint64 editMs = 0;
+        qint64 encodeMs = 0;
+    };
+
+    QStringList collectFiles() const;
+    // Output path of every file. Inputs sharing a base name (a.png and
+    // a.webp) keep their extension in it; one that still collides with
+    // another input's output maps to an empty path.
+    QHash<QString, QString> outputPaths(const QStringList& files) const;
+    FileResult processFile(const QString& filename, const QString& output) const;
+    // The edits for an image of sourceSize; false if the crop misses it
+    bool planEdits(const QSize& sourceSize, EditPipeline* edits) const;
+
+    BatchOptions m_options;
+};
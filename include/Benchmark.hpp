@@ -0,0 +1,11 @@
+#pragma once
+
+#include <QtCore/QStringList>
+
+// Headless timing of the pixel engines against the Qt equivalents they
+// replace, on synthetic images or given files
+class Benchmark {
+public:
+    // Entry point for "--benchmark": parses arguments and runs; returns the exit code
+    static int exec(const QStringList& arguments);
+};
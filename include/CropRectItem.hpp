@@ -32,6 +32,10 @@ public:
     QRectF rect() const;
     void setRect(const QRectF& r);
 
+    // The handles keep their size on screen, so the bounds change with the
+    // view's scale; call when it does
+    void viewScaleChanged();
+
     void setKeepAspectRatio(bool keep);
     bool keepAspectRatio() const { return m_keepAspectRatio; }
 
@@ -53,10 +57,11 @@ private:
     HandleType getHandleAt(const QPointF& pos);
     QRectF getHandleRect(HandleType handle);
     void updateCursor(HandleType handle);
+    qreal sceneHandleSize() const;
 
     HandleType currentHandle;
     QPointF lastMousePos;
-    qreal handleSize;
+    qreal handleSize; // On-screen size in pixels
     QRectF m_rect; // Store the rectangle as a member variable
     bool m_keepAspectRatio; // New member to control aspect ratio
 
@@ -11,6 +11,7 @@
 #include <QtWidgets/QGraphicsRectItem>
 #include <QtWidgets/QSpinBox>
 #include <QtWidgets/QLabel>
+#include <QtGui/QImage>
 
 // Forward declaration
 class ImageEditor;
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <QtCore/QRect>
+#include <QtCore/QSize>
+
+// Asks a decoder for less than the whole image at full size, so decode time
+// and memory follow what is needed rather than the file. Invalid fields
+// mean the whole image and its natural size.
+struct DecodeOptions {
+    QRect region; // Source pixels to decode; clipped to the image
+    QSize size;   // What region is scaled to while decoding
+
+    bool isFull() const { return !region.isValid() && !size.isValid(); }
+};
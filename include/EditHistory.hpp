@@ -0,0 +1,47 @@
+#pragma once
+
+#include <QtCore/QObject>
+#include <QtCore/QList>
+#include "EditPipeline.hpp"
+
+// Undo/redo stacks for the editor, bounded by a memory budget.
+//
+// Edits never change the source pixels (crops, rotations, flips and resizes
+// only change the EditPipeline), so an entry is the pipeline before the
+// edit and costs a few hundred bytes. When the history is over budget the
+// oldest entries are dropped.
+class EditHistory : public QObject {
+    Q_OBJECT
+
+public:
+    static constexpr qint64 DefaultMemoryBudget = 512ll * 1024 * 1024;
+
+    explicit EditHistory(QObject* parent = nullptr);
+    ~EditHistory() override;
+
+    void setMemoryBudget(qint64 bytes);
+    qint64 memoryBudget() const { return m_memoryBudget; }
+    qint64 memoryUsed() const;
+
+    // Record the pipeline before an edit; clears the redo stack
+    void recordEdits(const EditPipeline& before);
+
+    // edits holds the current pipeline on entry and the restored one on return
+    bool undo(EditPipeline* edits);
+    bool redo(EditPipeline* edits);
+
+    bool canUndo() const { return !m_undo.isEmpty(); }
+    bool canRedo() const { return !m_redo.isEmpty(); }
+    void clear();
+
+signals:
+    void changed();
+
+private:
+    bool step(QList<EditPipeline>& from, QList<EditPipeline>& to, EditPipeline* edits);
+    void enforceBudget();
+
+    QList<EditPipeline> m_undo; // Oldest first
+    QList<EditPipeline> m_redo; // Farthest first
+    qint64 m_memoryBudget;
+};
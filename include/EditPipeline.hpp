@@ -0,0 +1,111 @@
+#pragma once
+
+#include <QtCore/QRect>
+#include <QtCore/QSize>
+#include <QtCore/Qt>
+#include <QtGui/QImage>
+#include <QtGui/QTransform>
+#include "Resampler.hpp"
+
+// One of the eight axis-aligned orientations of an image: an optional
+// horizontal mirror followed by 0-3 clockwise quarter turns. Any sequence
+// of 90 degree rotations and flips collapses into a single Orientation.
+class Orientation {
+public:
+    Orientation() : m_quarterTurns(0), m_mirrored(false) {}
+
+    // degrees is clockwise and a multiple of 90
+    static Orientation rotation(int degrees);
+    static Orientation flip(Qt::Orientations orientations);
+
+    // This orientation followed by next
+    Orientation then(const Orientation& next) const;
+    Orientation inverted() const;
+
+    bool isIdentity() const { return m_quarterTurns == 0 && !m_mirrored; }
+    bool swapsAxes() const { return m_quarterTurns % 2 != 0; }
+    int quarterTurns() const { return m_quarterTurns; }
+    bool isMirrored() const { return m_mirrored; }
+
+    QSize mapSize(const QSize& size) const;
+    // Maps a rect in an image of sourceSize to the oriented image
+    QRect mapRect(const QRect& rect, const QSize& sourceSize) const;
+    // Continuous mapping of an image of sourceSize to the oriented image
+    QTransform transform(const QSize& sourceSize) const;
+
+    // Single pass over the pixels; threads as in ResampleOptions
+    QImage apply(const QImage& image, int threads = 0) const;
+    // Reuses image's buffer for 180 degrees and flips when nothing else
+    // shares it, so the image exists only once in memory
+    QImage apply(QImage&& image, int threads = 0) const;
+    // 180 degrees and flips (and the identity) of 8-64 bit images only;
+    // returns false, leaving image untouched, for anything else. Detaches
+    // image first if it is shared.
+    bool applyInPlace(QImage& image, int threads = 0) const;
+
+    bool operator==(const Orientation& other) const { return m_quarterTurns == other.m_quarterTurns && m_mirrored == other.m_mirrored; }
+    bool operator!=(const Orientation& other) const { return !(*this == other); }
+
+private:
+    Orientation(int quarterTurns, bool mirrored) : m_quarterTurns(((quarterTurns % 4) + 4) % 4), m_mirrored(mirrored) {}
+
+    int m_quarterTurns;
+    bool m_mirrored;
+};
+
+// Non-destructive chain of edits on a source image, kept in a normalized
+// form: a crop of the source, one orientation, then an optional resize.
+// Crops requested after a rotation, flip or resize are mapped back to
+// source coordinates and repeated resizes replace each other, so however
+// the edits were interleaved, apply() reads only the cropped source pixels,
+// resamples them once and writes each output pixel once.
+class EditPipeline {
+public:
+    explicit EditPipeline(const QSize& sourceSize = QSize());
+
+    // Rect is in the coordinates of the current output; it is clipped to it.
+    // Returns false (and changes nothing) if nothing would be left. After a
+    // resize the source crop is rounded to whole source pixels, while the
+    // output keeps exactly rect's size.
+    bool crop(const QRect& rect);
+    void orient(const Orientation& orientation);
+    void resize(const QSize& size, ResampleFilter filter = ResampleFilter::Lanczos3);
+
+    bool isIdentity() const;
+    bool isScaled() const { return m_scaledSize.isValid(); }
+    QSize sourceSize() const { return m_sourceSize; }
+    QRect sourceRect() const { return m_sourceRect; }
+    Orientation orientation() const { return m_orientation; }
+    ResampleFilter filter() const { return m_filter; }
+    QSize outputSize() const { return isScaled() ? m_scaledSize : orientedSize(); }
+
+    // Maps source image coordinates to output coordinates
+    QTransform transform() const;
+
+    // Materializes the edits on source, which must be of sourceSize().
+    // threads bounds the resampler's parallelism (see ResampleOptions).
+    QImage apply(const QImage& source, int threads = 0) const;
+    // Takes over source's buffer when nothing else shares it: a crop
+    // becomes a view into it, and flips and 180 degree turns run in place,
+    // so only resizes and quarter turns allocate pixels
+    QImage apply(QImage&& source, int threads = 0) const;
+
+    // Read-only image over rect (which must lie within image) that shares
+    // image's pixels: an offset and stride into the same buffer, kept alive
+    // by the view. The first write to the view copies just the region.
+    // Bit-packed formats are copied right away.
+    static QImage regionView(const QImage& image, const QRect& rect);
+    // Writable view that takes over image's buffer when nothing else
+    // shares it, so the region can also be edited without a copy
+    static QImage regionView(QImage&& image, const QRect& rect);
+
+private:
+    ResampleOptions resampleOptions(int threads) const;
+    QSize orientedSize() const { return m_orientation.mapSize(m_sourceRect.size()); }
+
+    QSize m_sourceSize;
+    QRect m_sourceRect;
+    Orientation m_orientation;
+    QSize m_scaledSize; // Invalid when the output is not resized
+    ResampleFilter m_filter = ResampleFilter::Lanczos3;
+};
@@ -7,6 +7,7 @@
 #include <QtWidgets/QDockWidget>
 #include <QtCore/QString>
 #include <QtWidgets/QGraphicsRectItem>
+#include <QtCore/QRect>
 #include <QtCore/QRectF>
 #include <QtCore/QList>
 #include <QtCore/QSize>
@@ -14,12 +15,22 @@
 #include <QtCore/QPointF>
 #include <CropRectItem.hpp>
 #include <ImageTool.hpp> // New include
+#include "EditPipeline.hpp"
+
+class TiledImageItem;
+class ImagePyramid;
+class EditHistory;
+class ThumbnailStrip;
+class TiledImage;
 
 class ImageEditor : public QMainWindow {
     Q_OBJECT
 
 signals:
     void imageChanged(); // New signal
+    void currentFileChanged(const QString& path);
+    // The view's scale changed; items sized in screen pixels follow it
+    void zoomChanged(qreal factor);
 
 public:
     explicit ImageEditor(QWidget* parent = nullptr);
@@ -27,38 +38,84 @@ public:
 
     // New public methods for tools to interact with
     QGraphicsScene* getGraphicsScene() const { return scene; }
-    QImage getCurrentImage() const { return currentImage; }
-    void setCurrentImage(const QImage& image) { currentImage = image; emit imageChanged(); } // Emit signal here
+    // Edits are non-destructive: the source pixels never change. Pending
+    // edits are shown from the display proxy and only replayed on the
+    // full-resolution source, in a single pass, when it is saved.
+    const QImage& getSourceImage() const { return currentImage; }
+    const EditPipeline& getPendingEdits() const { return m_pendingEdits; }
+    QSize getCurrentSize() const { return m_pendingEdits.outputSize(); }
+    bool hasImage() const { return !currentImage.isNull(); }
+    // Replaces the image with an unrelated one, e.g. a newly opened file;
+    // the edit history starts over
+    void setDocumentImage(const QImage& image);
+    // Same for an image kept in tiles (see TiledImage). overview, the whole
+    // image reduced, is what getSourceImage() returns and what is shown
+    // when zoomed out; edits and sizes are in the tiled image's pixels.
+    void setTiledDocument(const std::shared_ptr<TiledImage>& source, const QImage& overview);
+    // The full-resolution pixels of a tiled document, otherwise null
+    std::shared_ptr<TiledImage> getTiledSource() const { return m_tiledSource; }
+    // Geometric edits are recorded and displayed through the view transform;
+    // rect is in current image coordinates
+    void orientImage(const Orientation& orientation);
+    bool cropImage(const QRect& rect);
+    void resizeImage(const QSize& size, ResampleFilter filter = ResampleFilter::Lanczos3);
     void updateDisplay(); // Already exists, but ensure it's public
+    // Shows rows of an image that is still being decoded; the next
+    // updateDisplay() replaces the preview with the current image
+    void showPreviewRows(const QImage& rows, int firstRow, const QSize& fullSize);
+    // Shows a reduced decode of the whole image in its place until the
+    // next updateDisplay(); rows arriving meanwhile are not shown
+    void showScaledPreview(const QImage& preview, const QSize& fullSize);
     qreal getZoomFactor() const { return zoomFactor; }
     QString getCurrentFilePath() const { return m_currentFilePath; }
-    void setCurrentFilePath(const QString& path) { m_currentFilePath = path; }
-    void setZoomFactor(qreal factor) { zoomFactor = factor; }
+    void setCurrentFilePath(const QString& path);
+    // Zoom is applied as the view transform; scene coordinates stay in image pixels
+    void setZoomFactor(qreal factor);
     QGraphicsView* getGraphicsView() const { return view; }
+    EditHistory* getHistory() const { return m_history; }
+
+public slots:
+    void undo();
+    void redo();
 
 private slots:
+    void setHistoryBudget();
+    void setScratchDirectory();
 
 private:
     void setupUI();
     void setupToolsDock();
+    void setupThumbnailDock();
+    void setupEditMenu();
+    void replaceImage(const QImage& image);
+    void restoreEdits(const EditPipeline& edits);
     void updateTitle();
+    void centerImage();
     bool saveWebP(const QString& filename, int quality = 90);
     bool maybeSave();
     void setImage(const QImage& newImage);
-    QSize calculateZoomedSize() const;
 
     // UI Elements
     QGraphicsScene* scene;
     QGraphicsView* view;
     QDockWidget* toolsDock;
+    QDockWidget* thumbnailDock;
+    ThumbnailStrip* m_thumbnailStrip;
+    TiledImageItem* m_imageItem;
+    ImagePyramid* m_pyramid; // Downsampled levels of currentImage for zoomed-out display
 
     // Image state
-    QImage originalImage;
     QImage currentImage;
+    EditPipeline m_pendingEdits; // Crop, orientation and resize not yet applied to currentImage
+    std::shared_ptr<TiledImage> m_tiledSource; // Set for tiled documents; currentImage is then its overview
     QString m_currentFilePath;
+    bool m_showingPreview;
+    bool m_showingScaledPreview; // The preview is a reduced whole image, not rows
     
     // View state
     float zoomFactor;
 
+    EditHistory* m_history;
+
     QList<ImageTool*> m_imageTools;
 };
\ No newline at end of file
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <QtCore/QObject>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QSize>
+#include <QtGui/QImage>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include "DecodeOptions.hpp"
+
+class TiledImage;
+
+// Carries notifications from a load's worker thread back to the GUI thread.
+// The worker shares ownership and the object is released with deleteLater(),
+// so it stays valid even if the ImageLoader is destroyed first.
+class ImageLoadRelay : public QObject {
+    Q_OBJECT
+
+signals:
+    void progressChanged(int percent);
+    void rowsDecoded(const QImage& rows, int firstRow, const QSize& fullSize);
+    void previewDecoded(const QImage& preview, const QSize& fullSize);
+};
+
+// Decodes image files on a worker thread. Starting a new load cancels the
+// one in flight: its decoder is aborted and its result is dropped. WebP
+// files are streamed, reporting progress and the rows decoded so far; other
+// formats are read through a file that fails once cancelled, which stops
+// QImageReader at its next read. Files too large for one QImage are
+// decoded into a TiledImage.
+class ImageLoader : public QObject {
+    Q_OBJECT
+
+public:
+    explicit ImageLoader(QObject* parent = nullptr);
+    ~ImageLoader() override;
+
+    // With a valid fitSize, a file that is at least twice as large and
+    // canDecodeScaled() is also decoded scaled down to fit, next to the
+    // full decode, and shown through previewDecoded() as soon as that is done
+    void load(const QString& filename, const QSize& fitSize = QSize());
+    void cancel();
+    bool isLoading() const { return m_loading; }
+
+    // Synchronous decode of any supported file; WebP goes through WebPHandler
+    static QImage loadImage(const QString& filename);
+    // Decodes only options.region, at options.size. WebP does both inside
+    // the decoder, other formats through QImageReader's clip rect and scaled
+    // size where their plugin supports them natively (JPEG scales in the
+    // DCT domain); anything a decoder cannot do is done afterwards.
+    static QImage loadImage(const QString& filename, const DecodeOptions& options);
+    // Whether the decoder itself produces a reduced image, rather than
+    // decoding the whole image and scaling it afterwards
+    static bool canDecodeScaled(const QString& filename);
+    // Whether the decoder can produce a region without the whole image
+    static bool canDecodeRegion(const QString& filename);
+    // Decodes into a scratch-backed TiledImage, a band of rows at a time
+    // where a ScanlineReader reads the file or canDecodeRegion(), so the
+    // image never has to fit into memory; other files are decoded whole
+    // first. progress gets 0-100 and may return false to abort. Null on
+    // failure.
+    static std::unique_ptr<TiledImage> loadTiled(const QString& filename, const std::function<bool(int percent)>& progress = {});
+    // Size from the file's header, without decoding; invalid if unknown
+    static QSize imageSize(const QString& filename);
+    // The images in directory (not recursively), as paths sorted by name
+    static QStringList imageFiles(const QString& directory);
+
+signals:
+    void loadingChanged(bool loading);
+    void progressChanged(int percent);
+    // Early preview: rows [firstRow, firstRow + rows.height()) of an image of fullSize
+    void rowsDecoded(const QImage& rows, int firstRow, const QSize& fullSize);
+    // The whole image at a reduced size; fullSize is what it stands in for
+    void previewDecoded(const QImage& preview, const QSize& fullSize);
+    void imageLoaded(const QImage& image, const QString& filename);
+    // Instead of imageLoaded() for files TiledImage::needsTiling(): the
+    // pixels stay in tiles, overview is the whole image reduced to fit in
+    // memory for display
+    void tiledImageLoaded(const std::shared_ptr<TiledImage>& image, const QImage& overview, const QString& filename);
+    void loadFailed(const QString& filename);
+
+private:
+    void startTiledLoad(const QString& filename, const std::shared_ptr<std::atomic<bool>>& cancelled, const std::shared_ptr<ImageLoadRelay>& relay);
+
+    std::shared_ptr<std::atomic<bool>> m_cancelled; // Flag of the load in flight
+    bool m_loading;
+};
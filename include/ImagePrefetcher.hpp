@@ -0,0 +1,49 @@
+#pragma once
+
+#include <QtCore/QObject>
+#include <QtCore/QCache>
+#include <QtCore/QDateTime>
+#include <QtCore/QMutex>
+#include <QtCore/QSet>
+#include <QtCore/QStringList>
+#include <QtCore/QThreadPool>
+#include <QtGui/QImage>
+
+// Decodes the files next to the open one ahead of time, so stepping
+// through a folder shows them without waiting for the decoder. Decodes run
+// on a small pool of low-priority threads; the results are kept full size
+// in a cache bounded by bytes, dropping the least recently used first.
+class ImagePrefetcher : public QObject {
+    Q_OBJECT
+
+public:
+    static constexpr qint64 DefaultMemoryBudget = 512ll * 1024 * 1024;
+
+    explicit ImagePrefetcher(QObject* parent = nullptr);
+    ~ImagePrefetcher() override;
+
+    void setMemoryBudget(qint64 bytes);
+
+    // Decodes filenames in the order given, skipping cached ones; those
+    // queued by an earlier call and not listed again are not started
+    void prefetch(const QStringList& filenames);
+    // Removes and returns the image of filename, or null if it is not
+    // cached or the file changed since it was decoded
+    QImage take(const QString& filename);
+    // Caches an image already decoded elsewhere, e.g. the one being left
+    void insert(const QString& filename, const QImage& image);
+
+private:
+    struct Entry {
+        QImage image;
+        QDateTime modified;
+    };
+
+    void decode(const QString& filename);
+
+    QCache<QString, Entry> m_cache; // GUI thread only; cost in KiB
+    QMutex m_mutex;                 // Guards the two sets below
+    QSet<QString> m_queued;         // Wanted and not started
+    QSet<QString> m_decoding;
+    QThreadPool m_pool;
+};
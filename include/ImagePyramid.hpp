@@ -0,0 +1,57 @@
+#pragma once
+
+#include <QtCore/QObject>
+#include <QtCore/QFutureWatcher>
+#include <QtCore/QRect>
+#include <QtCore/QVector>
+#include <QtGui/QImage>
+
+// Mip-map pyramid (1/1, 1/2, 1/4, ...) of the displayed image, used to draw
+// zoomed-out views from a level close to the screen resolution instead of
+// downsampling the full-resolution image every time. Levels are built on a
+// worker thread; after an edit only the dirty region of each level is
+// recomputed. Until a build finishes, lookups fall back to the levels that
+// are already available (or the base image).
+class ImagePyramid : public QObject {
+    Q_OBJECT
+
+public:
+    // Levels stop once both sides fit into this many pixels
+    static constexpr int MinLevelSize = 256;
+
+    explicit ImagePyramid(QObject* parent = nullptr);
+    ~ImagePyramid() override;
+
+    // Sets the full-resolution image. If dirtyRect is valid and the size is
+    // unchanged, only that region is refreshed in the existing levels.
+    void setBaseImage(const QImage& image, const QRect& dirtyRect = QRect());
+
+    // Returns the smallest level that is still at least `scale` times the
+    // base size; its scale relative to the base is stored in levelScale.
+    QImage levelForScale(qreal scale, qreal* levelScale) const;
+
+    // Identifies the image the levels describe (see QImage::cacheKey())
+    qint64 baseCacheKey() const { return m_base.cacheKey(); }
+
+signals:
+    // Emitted when new level data is available. dirtyRect is in base image
+    // coordinates; an invalid rect means every level changed.
+    void levelsUpdated(const QRect& dirtyRect);
+
+private slots:
+    void onBuildFinished();
+
+private:
+    void startBuild();
+    static QVector<QImage> buildLevels(const QImage& base, QVector<QImage> levels, const QRect& dirtyRect);
+    static void halveRegion(const QImage& source, const QPoint& sourceOrigin, QImage& target, const QRect& targetRect);
+
+    QImage m_base;
+    QVector<QImage> m_levels; // m_levels[0] is the base, each next one half the size
+    QFutureWatcher<QVector<QImage>> m_watcher;
+    QRect m_pendingDirtyRect;
+    bool m_fullRebuildPending;
+    QRect m_buildDirtyRect;
+    int m_generation;
+    int m_buildGeneration;
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <QtCore/QObject>
+#include <QtCore/QString>
+#include <QtGui/QImage>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include "WebPHandler.hpp"
+#include "EditPipeline.hpp"
+
+class TiledImage;
+
+// Carries encoder progress from a save's worker thread to the GUI thread;
+// released with deleteLater() like ImageLoadRelay
+class ImageSaveRelay : public QObject {
+    Q_OBJECT
+
+signals:
+    void progressChanged(int percent);
+};
+
+// Encodes and writes images on a worker thread. The image passed to save()
+// is a snapshot (an implicitly shared copy), so the editor can keep changing
+// its own image while the file is written. Only one save runs at a time.
+class ImageSaver : public QObject {
+    Q_OBJECT
+
+public:
+    explicit ImageSaver(QObject* parent = nullptr);
+    ~ImageSaver() override;
+
+    // Applies edits to source on the worker first, so replaying them at
+    // full resolution does not block the caller either. WebP files use
+    // options; other formats go through QImage::save()
+    bool save(const QImage& source, const EditPipeline& edits, const QString& filename, const WebPEncodeOptions& options = WebPEncodeOptions());
+    // Same for a tiled source: the crop is read (and reduced, when resized)
+    // from its tiles. An output that still needs tiling can only be
+    // streamed to BMP; other formats fail for it.
+    bool save(const std::shared_ptr<TiledImage>& source, const EditPipeline& edits, const QString& filename, const WebPEncodeOptions& options = WebPEncodeOptions());
+    // Aborts the WebP encoder; the target file is left untouched
+    void cancel();
+    bool isSaving() const { return m_saving; }
+
+signals:
+    void savingChanged(bool saving);
+    // Only WebP saves report progress
+    void progressChanged(int percent);
+    void imageSaved(const QString& filename, const WebPEncodeStats& stats);
+    void saveFailed(const QString& filename);
+    void saveCancelled(const QString& filename);
+
+private:
+    // Runs write on the worker and reports its outcome; write gets options
+    // with progress hooked up to this saver and returns whether it succeeded
+    using WriteFunction = std::function<bool(const WebPEncodeOptions& options, const std::atomic<bool>& cancelled, WebPEncodeStats* stats)>;
+    bool start(const QString& filename, const WebPEncodeOptions& options, WriteFunction write);
+
+    std::shared_ptr<std::atomic<bool>> m_cancelled; // Flag of the save in flight
+    bool m_saving;
+};
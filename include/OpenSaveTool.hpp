@@ -5,9 +5,17 @@
 #include <QtWidgets/QPushButton>
 #include <QtWidgets/QVBoxLayout>
 #include <QtWidgets/QHBoxLayout>
+#include <QtWidgets/QProgressBar>
+#include <QtWidgets/QComboBox>
+#include <QtWidgets/QSpinBox>
+#include <QtGui/QImage>
+#include "WebPHandler.hpp"
 
 // Forward declaration
 class ImageEditor;
+class ImageLoader;
+class ImagePrefetcher;
+class ImageSaver;
 
 class OpenSaveTool : public QObject, public ImageTool {
     Q_OBJECT
@@ -21,15 +29,46 @@ public:
     QString getToolName() override;
     void setImageEditor(ImageEditor* editor) override;
 
+public slots:
+    // Opens fileName, e.g. from the thumbnail strip, once the user agreed
+    // to discard any edits; false if they chose to keep the open image
+    bool openFile(const QString& fileName);
+
+    // Steps through the images in the open file's folder, by name
+    void openPrevious();
+    void openNext();
+
 private slots:
     void openImage();
     void saveImage();
     void showImageInfo();
+    void onImageLoaded(const QImage& image, const QString& fileName);
+    void onLoadFailed(const QString& fileName);
+    void onImageSaved(const QString& fileName, const WebPEncodeStats& stats);
+    void onSaveFailed(const QString& fileName);
 
 private:
+    WebPEncodeOptions encodeOptions() const;
+    void openNeighbour(int offset);
+    // Asks before edits (anything undoable) are thrown away; true to go on
+    bool confirmDiscardEdits();
+    void loadFile(const QString& fileName);
+    // Enables stepping where there is a neighbour and decodes the nearest ones ahead
+    void updateNeighbours();
+
     ImageEditor* m_editor;
     QGroupBox* m_openSaveGroup;
     QPushButton* m_openBtn;
+    QPushButton* m_previousBtn;
+    QPushButton* m_nextBtn;
     QPushButton* m_saveBtn;
     QPushButton* m_infoBtn;
+    QProgressBar* m_loadProgress;
+    QComboBox* m_profileCombo;
+    QSpinBox* m_qualitySpinBox;
+    QProgressBar* m_saveProgress;
+    QPushButton* m_cancelSaveBtn;
+    ImageLoader* m_loader;
+    ImagePrefetcher* m_prefetcher;
+    ImageSaver* m_saver;
 };
\ No newline at end of file
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <QtCore/QList>
+#include <QtCore/QSize>
+#include <QtCore/QString>
+#include <QtGui/QImage>
+
+enum class ResampleFilter {
+    Box,
+    Bilinear,
+    Bicubic,
+    Lanczos3
+};
+
+// Highest instruction set the resampler may use; the CPU may cap it lower
+enum class SimdLevel {
+    None,
+    SSE41,
+    AVX2
+};
+
+struct ResampleOptions {
+    ResampleFilter filter = ResampleFilter::Lanczos3;
+    int threads = 0;                     // 0 uses every core, 1 stays on the calling thread
+    SimdLevel maxSimd = SimdLevel::AVX2;
+    bool boxReduction = true;            // Averages whole blocks first on large reductions
+};
+
+// Separable resampler: a horizontal pass, then a vertical one, each with
+// precomputed fixed-point weights. Both passes are split into bands of rows
+// that run in parallel, and the inner loops use SSE4.1 or AVX2 when the CPU
+// has them. Downscaling widens the filter, so every source pixel contributes
+// (antialiased like QImage's smooth scaling, but with a choice of filter).
+// Reductions of 4:1 and more first average whole NxN blocks, then filter
+// the remaining 2:1 to 4:1 step, which costs far less than running a
+// filter that wide and looks the same.
+class Resampler {
+public:
+    // Works on 8-bit-per-channel pixels; formats with more precision are
+    // handed to QImage::scaled() so they keep it. Alpha is filtered
+    // premultiplied and the result comes back in a format equivalent to the
+    // input's (indexed images come back as 32-bit).
+    static QImage resample(const QImage& image, const QSize& size, const ResampleOptions& options = ResampleOptions());
+
+    // Block size the box reduction uses along an axis; 1 when it is skipped
+    static int reductionFactor(int inSize, int outSize);
+
+    static SimdLevel supportedSimd();
+    static QString filterName(ResampleFilter filter);
+    static QString simdName(SimdLevel level);
+    static QList<ResampleFilter> filters();
+};
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Inner loops of Resampler, one set per instruction set. The SSE4.1 and
+// AVX2 versions live in their own translation units, compiled with the
+// matching flags, and are only called after a runtime CPU check.
+//
+// Pixels are 32-bit BGRA in memory (QImage RGB32/ARGB32_Premultiplied on
+// little-endian hosts). Weights are fixed point with WeightBits fraction
+// bits and sum to 1 for every output sample; results are rounded, clamped
+// to 0-255 and color channels clamped to alpha so premultiplied data stays
+// valid after filters with negative lobes.
+namespace ResamplerKernels
+{
+    constexpr int WeightBits = 14;
+    constexpr int Rounding = 1 << (WeightBits - 1);
+
+    // The helpers below are static: each kernel file compiles its own copy
+    // with its own instruction set, and the linker must not pick an AVX2
+    // copy for the scalar code.
+
+    static inline int toByte(int sum)
+    {
+        int value = sum >> WeightBits;
+        return value < 0 ? 0 : (value > 255 ? 255 : value);
+    }
+
+    static inline std::uint32_t packPixel(int b, int g, int r, int a)
+    {
+        int alpha = toByte(a);
+        int blue = toByte(b);
+        int green = toByte(g);
+        int red = toByte(r);
+        blue = blue < alpha ? blue : alpha;
+        green = green < alpha ? green : alpha;
+        red = red < alpha ? red : alpha;
+        return std::uint32_t(blue) | (std::uint32_t(green) << 8) | (std::uint32_t(red) << 16) | (std::uint32_t(alpha) << 24);
+    }
+
+    // One output pixel of the vertical pass; also finishes the rows the
+    // vector kernels leave over
+    static inline std::uint32_t verticalPixel(const std::uint32_t* const* rows, int x, const std::int16_t* weights, int taps)
+    {
+        int b = Rounding, g = Rounding, r = Rounding, a = Rounding;
+        for (int k = 0; k < taps; ++k)
+        {
+            std::uint32_t pixel = rows[k][x];
+            b += weights[k] * int(pixel & 0xff);
+            g += weights[k] * int((pixel >> 8) & 0xff);
+            r += weights[k] * int((pixel >> 16) & 0xff);
+            a += weights[k] * int(pixel >> 24);
+        }
+        return packPixel(b, g, r, a);
+    }
+
+    // Mean of a block from its per-channel sums; the float steps are the
+    // same in every kernel, so all of them round identically
+    static inline std::uint32_t averagePixel(std::uint32_t b, std::uint32_t g, std::uint32_t r, std::uint32_t a, float inverseArea)
+    {
+        auto mean = [inverseArea](std::uint32_t sum)
+        { return static_cast<std::uint32_t>(static_cast<float>(sum) * inverseArea + 0.5f); };
+        return mean(b) | (mean(g) << 8) | (mean(r) << 16) | (mean(a) << 24);
+    }
+
+    // Column sums are 16-bit, so a block may be at most this many rows high
+    constexpr int MaxReduceFactor = 256;
+
+    // out[x] = mean of columns [x * factorX, min((x + 1) * factorX, inWidth))
+    // over all rowCount rows; the last block may be narrower. columnSums is
+    // scratch for inWidth * 4 values.
+    using ReduceFn = void (*)(const std::uint32_t* const* rows, int rowCount, std::uint32_t* out,
+                              int inWidth, int factorX, std::uint16_t* columnSums);
+
+    // out[x] = sum over k < taps of weights[x * taps + k] * in[starts[x] + k]
+    using HorizontalFn = void (*)(const std::uint32_t* in, std::uint32_t* out, int outWidth,
+                                  const int* starts, const std::int16_t* weights, int taps);
+
+    // out[x] = sum over k < taps of weights[k] * rows[k][x]
+    using VerticalFn = void (*)(const std::uint32_t* const* rows, std::uint32_t* out, int width,
+                                const std::int16_t* weights, int taps);
+
+    void horizontalScalar(const std::uint32_t* in, std::uint32_t* out, int outWidth,
+                          const int* starts, const std::int16_t* weights, int taps);
+    void verticalScalar(const std::uint32_t* const* rows, std::uint32_t* out, int width,
+                        const std::int16_t* weights, int taps);
+    void reduceScalar(const std::uint32_t* const* rows, int rowCount, std::uint32_t* out,
+                      int inWidth, int factorX, std::uint16_t* columnSums);
+
+#if defined(EZ_RESAMPLER_X86)
+    void horizontalSSE41(const std::uint32_t* in, std::uint32_t* out, int outWidth,
+                         const int* starts, const std::int16_t* weights, int taps);
+    void verticalSSE41(const std::uint32_t* const* rows, std::uint32_t* out, int width,
+                       const std::int16_t* weights, int taps);
+    void reduceSSE41(const std::uint32_t* const* rows, int rowCount, std::uint32_t* out,
+                     int inWidth, int factorX, std::uint16_t* columnSums);
+    void horizontalAVX2(const std::uint32_t* in, std::uint32_t* out, int outWidth,
+                        const int* starts, const std::int16_t* weights, int taps);
+    void verticalAVX2(const std::uint32_t* const* rows, std::uint32_t* out, int width,
+                      const std::int16_t* weights, int taps);
+    void reduceAVX2(const std::uint32_t* const* rows, int rowCount, std::uint32_t* out,
+                    int inWidth, int factorX, std::uint16_t* columnSums);
+#endif
+}
@@ -5,9 +5,12 @@
 #include <QtWidgets/QPushButton>
 #include <QtWidgets/QSpinBox>
 #include <QtWidgets/QCheckBox>
+#include <QtWidgets/QComboBox>
 #include <QtWidgets/QVBoxLayout>
 #include <QtWidgets/QHBoxLayout>
 #include <QtWidgets/QLabel>
+#include <QtGui/QImage>
+#include "Resampler.hpp"
 
 // Forward declaration
 class ImageEditor;
@@ -26,6 +29,7 @@ public:
 
 private slots:
     void resizeImage();
+    void updateMethodHint();
 
 private:
     ImageEditor* m_editor;
@@ -33,4 +37,6 @@ private:
     QSpinBox* m_widthSpinBox;
     QSpinBox* m_heightSpinBox;
     QCheckBox* m_aspectRatioCheckBox;
+    QComboBox* m_filterComboBox;
+    QLabel* m_methodLabel;
 };
\ No newline at end of file
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <QtConcurrent/QtConcurrentMap>
+#include <QtCore/QThread>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+// Splits [0, count) into up to threads contiguous bands of at least minRows
+// and runs work(begin, end) on each, in parallel on the global thread pool.
+// threads 0 uses every core; a single band runs on the calling thread.
+template <typename Work>
+void forEachRowBand(int count, int threads, int minRows, const Work& work)
+{
+    if (threads <= 0)
+    {
+        threads = QThread::idealThreadCount();
+    }
+    int bandCount = std::min(threads, (count + minRows - 1) / minRows);
+    if (bandCount <= 1)
+    {
+        if (count > 0)
+        {
+            work(0, count);
+        }
+        return;
+    }
+    std::vector<std::pair<int, int>> bands;
+    bands.reserve(bandCount);
+    for (int band = 0; band < bandCount; ++band)
+    {
+        bands.emplace_back(static_cast<int>(qint64(count) * band / bandCount),
+                           static_cast<int>(qint64(count) * (band + 1) / bandCount));
+    }
+    QtConcurrent::blockingMap(bands, [&work](const std::pair<int, int>& band)
+                              { work(band.first, band.second); });
+}
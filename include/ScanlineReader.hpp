@@ -0,0 +1,44 @@
+#pragma once
+
+#include <QtCore/QSize>
+#include <QtCore/QString>
+#include <QtGui/QImage>
+#include <memory>
+
+// Reads an image file from the top down a band of rows at a time, for
+// files too large to decode into one QImage: only the band asked for and
+// the decoder's own row buffers are in memory at once. Uncompressed BMP is
+// read directly, PNG and JPEG through libpng and libjpeg where the build
+// found them (EZ_HAVE_LIBPNG, EZ_HAVE_LIBJPEG). Files that cannot be read
+// in order, such as interlaced PNG and progressive or CMYK JPEG, get no
+// reader.
+class ScanlineReader {
+public:
+    virtual ~ScanlineReader() = default;
+    ScanlineReader(const ScanlineReader&) = delete;
+    ScanlineReader& operator=(const ScanlineReader&) = delete;
+
+    // Null if filename cannot be read row by row
+    static std::unique_ptr<ScanlineReader> open(const QString& filename);
+
+    QSize size() const { return m_size; }
+    // Rows are Format_ARGB32 if true, Format_RGB32 otherwise
+    bool hasAlpha() const { return m_hasAlpha; }
+
+    // The next count rows (fewer at the bottom); null past the end or on a
+    // read error
+    QImage read(int count);
+
+protected:
+    ScanlineReader() = default;
+    void setFormat(const QSize& size, bool hasAlpha);
+    // Index of the first row read() asks for next
+    int nextRow() const { return m_nextRow; }
+    // Fills every row of rows, which is in the format above
+    virtual bool readRows(QImage& rows) = 0;
+
+private:
+    QSize m_size;
+    bool m_hasAlpha = false;
+    int m_nextRow = 0;
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <QtCore/QObject>
+#include <QtCore/QCache>
+#include <QtCore/QSet>
+#include <QtCore/QString>
+#include <QtCore/QThreadPool>
+#include <QtGui/QImage>
+
+class QFileInfo;
+
+// Small previews of image files, for browsing a folder without opening
+// every file. Thumbnails are generated on a pool of low-priority threads,
+// decoding at a reduced size where the format allows it, and kept in two
+// levels: a memory cache dropping the least recently used ones beyond its
+// budget, and WebP files in the user's cache directory, named after the
+// path, size and modification time of the source so that an edited file
+// gets a new thumbnail. The files of edited or moved sources are left
+// behind, so the directory is pruned to its own budget, least recently
+// used first, at startup and every so many thumbnails.
+class ThumbnailCache : public QObject {
+    Q_OBJECT
+
+public:
+    // Longest side of a thumbnail
+    static constexpr int Edge = 128;
+    static constexpr qint64 DefaultMemoryBudget = 64ll * 1024 * 1024;
+    static constexpr qint64 DefaultDiskBudget = 128ll * 1024 * 1024;
+
+    explicit ThumbnailCache(QObject* parent = nullptr);
+    ~ThumbnailCache() override;
+
+    void setMemoryBudget(qint64 bytes);
+    // Takes effect at the next pruning
+    void setDiskBudget(qint64 bytes);
+
+    // Returns the thumbnail if it is in memory. Otherwise it is read from
+    // disk or generated, and thumbnailReady() follows; requests with a
+    // higher priority start first.
+    QImage request(const QString& filename, int priority = 0);
+    // Drops the requests that have not started yet
+    void cancelPending();
+
+    static QString diskCacheDirectory();
+
+signals:
+    // thumbnail is null when the file could not be decoded
+    void thumbnailReady(const QString& filename, const QImage& thumbnail);
+
+private:
+    static QString cacheKey(const QFileInfo& info);
+    static QImage loadOrGenerate(const QString& filename, const QString& diskPath);
+    static QImage generate(const QString& filename);
+    // Queues the pruning of the disk cache behind every pending request
+    void schedulePrune();
+    // Deletes the least recently used files until the rest fit into bytes
+    static void pruneDirectory(const QString& directory, qint64 bytes);
+
+    QCache<QString, QImage> m_memory; // By cacheKey(), cost in KiB
+    QSet<QString> m_pending;          // Keys queued or being generated
+    QString m_directory;
+    qint64 m_diskBudget;
+    int m_sincePrune; // Thumbnails delivered since pruning was last queued
+    QThreadPool m_pool;
+};
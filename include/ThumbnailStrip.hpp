@@ -0,0 +1,32 @@
+#pragma once
+
+#include <QtWidgets/QListWidget>
+#include <QtCore/QHash>
+#include <QtCore/QString>
+#include <QtGui/QImage>
+
+class ThumbnailCache;
+
+// Filmstrip of the images in the open file's folder. Thumbnails come from
+// a ThumbnailCache and fill in as they arrive, nearest to the open file
+// first; clicking one asks for that file to be opened.
+class ThumbnailStrip : public QListWidget {
+    Q_OBJECT
+
+public:
+    explicit ThumbnailStrip(QWidget* parent = nullptr);
+
+    // Lists the folder of filename and marks filename; staying in the same
+    // folder only moves the mark
+    void showFolderOf(const QString& filename);
+
+signals:
+    void fileActivated(const QString& filename);
+
+private:
+    void onThumbnailReady(const QString& filename, const QImage& thumbnail);
+
+    ThumbnailCache* m_cache;
+    QString m_directory;
+    QHash<QString, QListWidgetItem*> m_items; // By file path
+};
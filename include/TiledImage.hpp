@@ -0,0 +1,87 @@
+#pragma once
+
+#include <QtCore/QMutex>
+#include <QtCore/QRect>
+#include <QtCore/QSize>
+#include <QtCore/QString>
+#include <QtCore/QTemporaryFile>
+#include <QtGui/QImage>
+#include <memory>
+#include <vector>
+#include "EditPipeline.hpp"
+
+// Image too large to keep in one QImage (or in RAM at all), stored as
+// square tiles in a scratch file. Tiles are memory-mapped on demand and
+// unmapped again least recently used first once more than the mapped
+// budget is, so the operating system pages pixels in and out rather than
+// the whole image having to fit into memory. Only 32-bit formats are
+// stored; every operation works a tile or a band of rows at a time and is
+// safe to run from several threads.
+class TiledImage {
+public:
+    static constexpr int TileSize = 512;
+    static constexpr qint64 DefaultMappedBudget = 256ll * 1024 * 1024;
+    // Images of more bytes than this are opened as a TiledImage
+    static constexpr qint64 MaxInMemoryBytes = 1024ll * 1024 * 1024;
+    // Largest side the size fields of the tools accept
+    static constexpr int MaxSide = 1 << 20;
+
+    // Null if the scratch file cannot be created, e.g. for lack of disk space
+    TiledImage(const QSize& size, QImage::Format format);
+    ~TiledImage();
+    TiledImage(const TiledImage&) = delete;
+    TiledImage& operator=(const TiledImage&) = delete;
+
+    // Whether an image of size is too large to be kept in one QImage
+    static bool needsTiling(const QSize& size);
+    // Where scratch files of images made from now on go; by default a
+    // folder in the cache location rather than the temporary directory,
+    // which is often memory-backed. An empty directory restores the default
+    static void setScratchDirectory(const QString& directory);
+    static QString scratchDirectory();
+
+    bool isNull() const { return m_tiles.empty(); }
+    QSize size() const { return m_size; }
+    QRect rect() const { return QRect(QPoint(0, 0), m_size); }
+    QImage::Format format() const { return m_format; }
+    void setMappedBudget(qint64 bytes);
+
+    // Copy of rect, which must lie within the image and fit into memory
+    QImage read(const QRect& rect) const;
+    // Copies image into the tiles it covers, with its top left at offset
+    bool write(const QImage& image, const QPoint& offset);
+    // rect shrunk by averaging factor x factor blocks (partial ones at the
+    // right and bottom edge), reading a band of rows at a time
+    QImage reduced(const QRect& rect, int factor, int threads = 0) const;
+    // crop, then orientation, into a new scratch-backed image, assembled
+    // one output tile at a time; null if the scratch file cannot be made
+    std::unique_ptr<TiledImage> transformed(const QRect& crop, const Orientation& orientation, int threads = 0) const;
+
+    // Streams the pixels into a 24-bit BMP one band of rows at a time, the
+    // one format written here without the whole image in memory
+    bool saveBmp(const QString& filename) const;
+
+private:
+    struct Tile {
+        uchar* data = nullptr; // Mapped pixels, null while unmapped
+        int pins = 0;          // Views and copies in progress; not unmapped meanwhile
+    };
+
+    int tileColumns() const { return (m_size.width() + TileSize - 1) / TileSize; }
+    int tileRows() const { return (m_size.height() + TileSize - 1) / TileSize; }
+    QRect tileRect(int column, int row) const;
+    // Maps tile index (if needed) and pins it until release()
+    uchar* acquire(int index) const;
+    void release(int index) const;
+    // Copies between rect of the image and rows of target/source, whose
+    // top left corresponds to rect's; forWrite picks the direction
+    bool copyRect(const QRect& rect, uchar* bits, qsizetype bytesPerLine, bool forWrite) const;
+
+    QSize m_size;
+    QImage::Format m_format;
+    qint64 m_mappedBudget;
+    mutable QMutex m_mutex; // Guards the file, the tiles and the mapped list
+    mutable QTemporaryFile m_file;
+    mutable std::vector<Tile> m_tiles;
+    mutable std::vector<int> m_mapped; // Tile indices, least recently used first
+};
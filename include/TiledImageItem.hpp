@@ -0,0 +1,83 @@
+#pragma once
+
+#include <QtWidgets/QGraphicsObject>
+#include <QtGui/QImage>
+#include <QtGui/QPixmap>
+#include <QtCore/QCache>
+#include <QtCore/QRect>
+#include <QtCore/QSet>
+#include <QtCore/QSize>
+#include <QtCore/QThreadPool>
+#include <memory>
+
+class ImagePyramid;
+class TiledImage;
+
+// Displays an image as a grid of cached pixmap tiles. Item coordinates are
+// image pixels; zooming is done by the view transform. Tiles are rasterized
+// at the view's level of detail (never above 1:1, see setDetailSource()) and only where they
+// intersect the exposed part of the viewport, so a repaint costs
+// O(viewport) instead of O(image), and an edit only has to drop the tiles
+// it actually touched.
+class TiledImageItem : public QGraphicsObject {
+    Q_OBJECT
+
+public:
+    static constexpr int TileSize = 256;
+
+    explicit TiledImageItem(QGraphicsItem* parent = nullptr);
+    ~TiledImageItem() override;
+
+    // Replaces the displayed image. If dirtyRect (in image coordinates) is
+    // valid and the size is unchanged, only the tiles it covers are dropped.
+    void setImage(const QImage& image, const QRect& dirtyRect = QRect());
+    QImage image() const { return m_image; }
+
+    // Copies rows into the displayed image in place (starting at firstRow)
+    // and refreshes only their tiles; used for progressive previews
+    void writeRows(const QImage& rows, int firstRow);
+
+    // Zoomed-out tiles are drawn from the nearest pyramid level when set
+    void setPyramid(const ImagePyramid* pyramid) { m_pyramid = pyramid; }
+    // Full-resolution pixels for an image that is a reduced overview:
+    // zoomed in past 1:1, tiles are read from source instead of magnifying
+    // the overview, down to source's own 1:1. They are read on worker
+    // threads; the overview is magnified in their place until they arrive.
+    void setDetailSource(const std::shared_ptr<const TiledImage>& source);
+    // Called when pyramid levels were refreshed; only zoomed-out tiles care
+    void pyramidUpdated(const QRect& imageRect);
+
+    // Restricts display to rect (image coordinates), e.g. a pending crop;
+    // an invalid rect shows the whole image
+    void setSourceRect(const QRect& rect);
+
+    // Drops the cached tiles covering imageRect (image coordinates)
+    void invalidate(const QRect& imageRect);
+    void invalidateAll();
+
+    QRectF boundingRect() const override;
+    void paint(QPainter* painter, const QStyleOptionGraphicsItem* option, QWidget* widget = nullptr) override;
+
+private:
+    QPixmap renderTile(int column, int row) const;
+    QRect displayTileRect(int column, int row) const;
+    // Queues reading the detail tile at column, row unless already pending
+    void requestDetailTile(int column, int row);
+    void detailTileReady(int column, int row, int generation, const QImage& tile);
+    static QImage renderDetailTile(const TiledImage& detail, const QRect& tileRect, qreal stepX, qreal stepY);
+    // Drops every tile, cached or still being read
+    void dropTiles();
+    QSize tileGridSize() const;
+    static quint64 tileKey(int column, int row) { return (quint64(quint32(row)) << 32) | quint32(column); }
+
+    QImage m_image;
+    QRect m_sourceRect;
+    const ImagePyramid* m_pyramid;
+    std::shared_ptr<const TiledImage> m_detail;
+    qreal m_tileScale; // Scale the cached tiles were rasterized at
+    QCache<quint64, QPixmap> m_tileCache; // Cost is in KiB
+    QThreadPool m_detailPool;
+    QSet<quint64> m_pendingDetail; // Tiles being read for m_detailGeneration
+    int m_detailGeneration;        // Bumped whenever pending results go stale
+    int m_detailRequests;          // Newest requests run first, see requestDetailTile()
+};
@@ -1,14 +1,53 @@
 #pragma once
 
 #include <QtCore/QString>
+#include <QtCore/QIODevice>
 #include <QtGui/QImage>
+#include <functional>
+#include "DecodeOptions.hpp"
+
+// Speed/size trade-offs, from quickest to smallest output
+enum class WebPEncodeProfile {
+    Fast,
+    Balanced,
+    MaxCompression,
+    Lossless
+};
+
+struct WebPEncodeOptions {
+    WebPEncodeProfile profile = WebPEncodeProfile::Balanced;
+    int quality = 90; // 0-100, ignored by the Lossless profile
+    // Write to a temporary file that replaces the target only on success
+    bool atomicWrite = true;
+    // Called from the encoding thread with 0-100; return false to abort
+    std::function<bool(int percent)> progress;
+};
+
+struct WebPEncodeStats {
+    qint64 encodeMs = 0;
+    qint64 outputBytes = 0;
+    WebPEncodeProfile profile = WebPEncodeProfile::Balanced; // The one the encode used
+};
 
 class WebPHandler {
 public:
-    static bool encode(const QImage& image, const QString& filename, int quality = 90);
+    // Called by decodeIncremental() after every chunk fed to the decoder.
+    // Rows [0, decodedRows) of image are final; return false to abort.
+    using DecodeProgressCallback = std::function<bool(const QImage& image, int decodedRows, qint64 bytesRead, qint64 totalBytes)>;
+
+    static bool encode(const QImage& image, const QString& filename, const WebPEncodeOptions& options = WebPEncodeOptions(), WebPEncodeStats* stats = nullptr);
+    // Streams the bitstream to device while encoding, without buffering it
+    static bool encode(const QImage& image, QIODevice* device, const WebPEncodeOptions& options = WebPEncodeOptions(), WebPEncodeStats* stats = nullptr);
     static QImage decode(const QString& filename);
+    // Crops and scales inside libwebp, which never produces the full-size
+    // image. Lossy files can only be cropped at even offsets: without
+    // scaling the extra column or row is cut off again (no copy), with
+    // scaling the region may start up to one source pixel early.
+    static QImage decode(const QString& filename, const DecodeOptions& options);
+    // Canvas size from the headers, without decoding; invalid if unreadable
+    static QSize imageSize(const QString& filename);
 
-private:
-    static uint8_t* convertToRGBA(const QImage& image, int* width, int* height);
-    static QImage convertFromRGBA(const uint8_t* data, int width, int height, bool hasAlpha);
+    // Streams the file through WebPIDecoder in chunkSize pieces, so callers
+    // can show the top of the image before the rest has been read
+    static QImage decodeIncremental(const QString& filename, const DecodeProgressCallback& progress, int chunkSize = 64 * 1024);
 };
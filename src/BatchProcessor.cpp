@@ -0,0 +1,507 @@
+#include "BatchProcessor.hpp"
+#include "ImageLoader.hpp"
+#include "EditPipeline.hpp"
+#include "TiledImage.hpp"
+#include <QtConcurrent/QtConcurrentMap>
+#include <QtCore/QCommandLineParser>
+#include <QtCore/QDir>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSet>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QTextStream>
+#include <QtCore/QThread>
+#include <QtCore/QThreadPool>
+#include <utility>
+
+namespace
+{
+    // Workers report as they finish, so lines must not interleave
+    QMutex outputMutex;
+
+    void printLine(FILE *stream, const QString &line)
+    {
+        QMutexLocker locker(&outputMutex);
+        QTextStream(stream) << line << Qt::endl;
+    }
+
+    // The part of edits a decoder can take over: the crop, and the
+    // whole-block averaging Resampler would start a large reduction with
+    DecodeOptions decodeOptions(const EditPipeline &edits)
+    {
+        DecodeOptions options;
+        const QRect crop = edits.sourceRect();
+        if (crop != QRect(QPoint(0, 0), edits.sourceSize()))
+        {
+            options.region = crop;
+        }
+        if (edits.isScaled())
+        {
+            // The output size, in the orientation of the source
+            QSize target = edits.orientation().inverted().mapSize(edits.outputSize());
+            int factorX = Resampler::reductionFactor(crop.width(), target.width());
+            int factorY = Resampler::reductionFactor(crop.height(), target.height());
+            if (factorX > 1 || factorY > 1)
+            {
+                options.size = QSize((crop.width() + factorX - 1) / factorX, (crop.height() + factorY - 1) / factorY);
+            }
+        }
+        return options;
+    }
+
+    // What is left of edits for the image the decoder produced with decoded
+    EditPipeline remainingEdits(const EditPipeline &edits, const DecodeOptions &decoded, const QSize &decodedSize)
+    {
+        if (decoded.isFull())
+        {
+            return edits;
+        }
+        EditPipeline remaining(decodedSize);
+        remaining.orient(edits.orientation());
+        if (edits.isScaled())
+        {
+            remaining.resize(edits.outputSize(), edits.filter());
+        }
+        return remaining;
+    }
+
+    // The largest image decoding filename with decode allocates: the whole
+    // image wherever the decoder cannot clip or scale by itself
+    QSize peakDecodeSize(const QString &filename, const QSize &sourceSize, const DecodeOptions &decode)
+    {
+        if (decode.isFull())
+        {
+            return sourceSize;
+        }
+        if (decode.region.isValid())
+        {
+            if (!ImageLoader::canDecodeRegion(filename))
+            {
+                return sourceSize;
+            }
+            return decode.size.isValid() && ImageLoader::canDecodeScaled(filename) ? decode.size : decode.region.size();
+        }
+        return ImageLoader::canDecodeScaled(filename) ? decode.size : sourceSize;
+    }
+
+    double megabytes(qint64 bytes)
+    {
+        return bytes / 1e6;
+    }
+
+    // "WIDTHxHEIGHT", either side may be 0
+    bool parseSize(const QString &text, QSize *size)
+    {
+        QStringList parts = text.split('x', Qt::KeepEmptyParts, Qt::CaseInsensitive);
+        bool widthOk = false;
+        bool heightOk = false;
+        if (parts.size() != 2)
+        {
+            return false;
+        }
+        int width = parts[0].toInt(&widthOk);
+        int height = parts[1].toInt(&heightOk);
+        if (!widthOk || !heightOk || width < 0 || height < 0 || (width == 0 && height == 0))
+        {
+            return false;
+        }
+        *size = QSize(width, height);
+        return true;
+    }
+
+    // "X,Y,WIDTH,HEIGHT"
+    bool parseRect(const QString &text, QRect *rect)
+    {
+        QStringList parts = text.split(',');
+        if (parts.size() != 4)
+        {
+            return false;
+        }
+        int values[4];
+        for (int i = 0; i < 4; ++i)
+        {
+            bool ok = false;
+            values[i] = parts[i].trimmed().toInt(&ok);
+            if (!ok)
+            {
+                return false;
+            }
+        }
+        *rect = QRect(values[0], values[1], values[2], values[3]);
+        return rect->isValid();
+    }
+
+    bool parseProfile(const QString &text, WebPEncodeProfile *profile)
+    {
+        QString name = text.toLower();
+        if (name == "fast")
+            *profile = WebPEncodeProfile::Fast;
+        else if (name == "balanced")
+            *profile = WebPEncodeProfile::Balanced;
+        else if (name == "max")
+            *profile = WebPEncodeProfile::MaxCompression;
+        else if (name == "lossless")
+            *profile = WebPEncodeProfile::Lossless;
+        else
+            return false;
+        return true;
+    }
+
+    bool parseFilter(const QString &text, ResampleFilter *filter)
+    {
+        for (ResampleFilter candidate : Resampler::filters())
+        {
+            if (Resampler::filterName(candidate).compare(text, Qt::CaseInsensitive) == 0)
+            {
+                *filter = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+BatchProcessor::BatchProcessor(const BatchOptions &options)
+    : m_options(options)
+{
+}
+
+int BatchProcessor::run()
+{
+    const QStringList files = collectFiles();
+    if (files.isEmpty())
+    {
+        printLine(stderr, QString("No input images found."));
+        return 0;
+    }
+    if (!QDir().mkpath(m_options.outputDirectory))
+    {
+        printLine(stderr, QString("Cannot create output directory %1").arg(m_options.outputDirectory));
+        return files.size();
+    }
+
+    // A private pool, so --threads does not resize the global one
+    QThreadPool pool;
+    pool.setMaxThreadCount(m_options.threads > 0 ? m_options.threads : QThread::idealThreadCount());
+    printLine(stdout, QString("Processing %1 files on %2 threads").arg(files.size()).arg(pool.maxThreadCount()));
+
+    const QHash<QString, QString> outputs = outputPaths(files);
+
+    QElapsedTimer wallClock;
+    wallClock.start();
+    const QList<FileResult> results = QtConcurrent::blockingMapped<QList<FileResult>>(&pool, files, [this, &outputs](const QString &filename)
+                                                                                     {
+        FileResult result = processFile(filename, outputs.value(filename));
+        if (result.success)
+        {
+            printLine(stdout, QString("%1 -> %2: %3 ms (decode %4, edit %5, encode %6), %7 MB -> %8 MB")
+                                  .arg(QFileInfo(result.input).fileName(), QFileInfo(result.output).fileName())
+                                  .arg(result.decodeMs + result.editMs + result.encodeMs)
+                                  .arg(result.decodeMs)
+                                  .arg(result.editMs)
+                                  .arg(result.encodeMs)
+                                  .arg(megabytes(result.inputBytes), 0, 'f', 2)
+                                  .arg(megabytes(result.outputBytes), 0, 'f', 2));
+        }
+        else
+        {
+            printLine(stderr, QString("%1: %2").arg(QFileInfo(result.input).fileName(), result.error));
+        }
+        return result; });
+    qint64 elapsedMs = qMax<qint64>(1, wallClock.elapsed());
+
+    int failures = 0;
+    qint64 inputBytes = 0;
+    qint64 outputBytes = 0;
+    for (const FileResult &result : results)
+    {
+        if (!result.success)
+        {
+            ++failures;
+            continue;
+        }
+        inputBytes += result.inputBytes;
+        outputBytes += result.outputBytes;
+    }
+
+    double seconds = elapsedMs / 1000.0;
+    int processed = static_cast<int>(results.size()) - failures;
+    printLine(stdout, QString("Done: %1 processed, %2 failed in %3 s; %4 images/s, %5 MB/s read, %6 MB/s written")
+                          .arg(processed)
+                          .arg(failures)
+                          .arg(seconds, 0, 'f', 2)
+                          .arg(processed / seconds, 0, 'f', 2)
+                          .arg(megabytes(inputBytes) / seconds, 0, 'f', 2)
+                          .arg(megabytes(outputBytes) / seconds, 0, 'f', 2));
+    return failures;
+}
+
+QStringList BatchProcessor::collectFiles() const
+{
+    QStringList files;
+    QSet<QString> seen; // A file named twice (or inside a listed directory too) runs once
+    auto add = [&](const QString &file)
+    {
+        if (!seen.contains(QFileInfo(file).absoluteFilePath()))
+        {
+            seen.insert(QFileInfo(file).absoluteFilePath());
+            files.append(file);
+        }
+    };
+    for (const QString &input : m_options.inputs)
+    {
+        QFileInfo info(input);
+        if (info.isDir())
+        {
+            for (const QString &file : ImageLoader::imageFiles(input))
+            {
+                add(file);
+            }
+        }
+        else
+        {
+            add(input); // Missing files are reported by processFile()
+        }
+    }
+    return files;
+}
+
+QHash<QString, QString> BatchProcessor::outputPaths(const QStringList &files) const
+{
+    // Compared case-insensitively, as the output directory may be
+    auto key = [](const QString &name)
+    { return name.toLower(); };
+
+    QHash<QString, int> baseNameCount;
+    for (const QString &file : files)
+    {
+        ++baseNameCount[key(QFileInfo(file).completeBaseName())];
+    }
+
+    const QDir outputDirectory(m_options.outputDirectory);
+    QHash<QString, QString> outputs;
+    QHash<QString, int> outputCount;
+    for (const QString &file : files)
+    {
+        const QFileInfo info(file);
+        QString name = info.completeBaseName();
+        if (baseNameCount.value(key(name)) > 1)
+        {
+            name = info.fileName(); // a.png -> a.png.webp, next to a.webp -> a.webp.webp
+        }
+        outputs.insert(file, outputDirectory.filePath(name + "." + m_options.outputFormat));
+        ++outputCount[key(name)];
+    }
+
+    // Same names from different directories would still overwrite each other
+    for (auto it = outputs.begin(); it != outputs.end(); ++it)
+    {
+        if (outputCount.value(key(QFileInfo(it.value()).completeBaseName())) > 1)
+        {
+            it.value().clear();
+        }
+    }
+    return outputs;
+}
+
+BatchProcessor::FileResult BatchProcessor::processFile(const QString &filename, const QString &output) const
+{
+    FileResult result;
+    result.input = filename;
+    result.output = output;
+    result.inputBytes = QFileInfo(filename).size();
+    if (output.isEmpty())
+    {
+        result.error = QString("output name collides with another input's; rename one of them");
+        return result;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // When the header gives the size, the crop and most of a large
+    // reduction are left to the decoder, so decoding costs what the output
+    // needs rather than what the file holds
+    EditPipeline edits;
+    DecodeOptions decode;
+    const QSize sourceSize = ImageLoader::imageSize(filename);
+    if (sourceSize.isValid())
+    {
+        if (!planEdits(sourceSize, &edits))
+        {
+            result.error = QString("crop area is outside the image");
+            return result;
+        }
+        decode = decodeOptions(edits);
+
+        // Batch mode has no tiled path, and Qt's own allocation limit is
+        // lifted in main(), so what would not fit into one QImage stops here
+        if (TiledImage::needsTiling(sourceSize) && TiledImage::needsTiling(peakDecodeSize(filename, sourceSize, decode)))
+        {
+            result.error = QString("image too large (%1x%2); crop or resize it to what fits into memory")
+                               .arg(sourceSize.width())
+                               .arg(sourceSize.height());
+            return result;
+        }
+    }
+    QImage image = ImageLoader::loadImage(filename, decode);
+    result.decodeMs = timer.restart();
+    if (image.isNull())
+    {
+        result.error = QString("could not decode");
+        return result;
+    }
+    if (!sourceSize.isValid() && !planEdits(image.size(), &edits))
+    {
+        result.error = QString("crop area is outside the image");
+        return result;
+    }
+
+    // Files already run in parallel, one per core; resampling each on its
+    // own worker avoids oversubscribing the machine. The decoded image is
+    // ours alone, so crops, flips and 180 degree turns reuse its buffer.
+    image = remainingEdits(edits, decode, image.size()).apply(std::move(image), 1);
+    result.editMs = timer.restart();
+    if (image.isNull())
+    {
+        result.error = QString("out of memory while editing");
+        return result;
+    }
+
+    if (m_options.outputFormat.compare("webp", Qt::CaseInsensitive) == 0)
+    {
+        WebPEncodeStats stats;
+        result.success = WebPHandler::encode(image, result.output, m_options.encode, &stats);
+        result.outputBytes = stats.outputBytes;
+    }
+    else
+    {
+        result.success = image.save(result.output);
+        result.outputBytes = QFileInfo(result.output).size();
+    }
+    result.encodeMs = timer.elapsed();
+    if (!result.success)
+    {
+        result.error = QString("could not write %1").arg(result.output);
+    }
+    return result;
+}
+
+bool BatchProcessor::planEdits(const QSize &sourceSize, EditPipeline *edits) const
+{
+    // Crop, rotation, flip and resize go through one pipeline: the cropped
+    // source is resampled once and every output pixel written once
+    *edits = EditPipeline(sourceSize);
+    if (m_options.crop.isValid() && !edits->crop(m_options.crop))
+    {
+        return false;
+    }
+    edits->orient(Orientation::rotation(m_options.rotation).then(Orientation::flip(m_options.flip)));
+
+    if (m_options.size.isValid())
+    {
+        QSize current = edits->outputSize();
+        QSize size = m_options.size;
+        if (size.width() == 0)
+        {
+            size.setWidth(qMax(1, qRound(static_cast<double>(size.height()) * current.width() / current.height())));
+        }
+        else if (size.height() == 0)
+        {
+            size.setHeight(qMax(1, qRound(static_cast<double>(size.width()) * current.height() / current.width())));
+        }
+        edits->resize(size, m_options.filter);
+    }
+    return true;
+}
+
+int BatchProcessor::exec(const QStringList &arguments)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Applies the same edits to many images without the GUI.");
+    parser.addHelpOption();
+    QCommandLineOption batchOption("batch", "Run headless batch processing.");
+    QCommandLineOption outputOption(QStringList{"o", "output"}, "Directory the results are written to.", "dir");
+    QCommandLineOption resizeOption("resize", "Output size WIDTHxHEIGHT; a 0 side keeps the aspect ratio.", "size");
+    QCommandLineOption rotateOption("rotate", "Clockwise rotation in degrees: 90, 180 or 270.", "degrees");
+    QCommandLineOption flipOption("flip", "Flip horizontally (h), vertically (v) or both (hv).", "axes");
+    QCommandLineOption cropOption("crop", "Crop X,Y,WIDTH,HEIGHT in source pixels, applied first.", "rect");
+    QCommandLineOption filterOption("filter", "Resize filter: box, bilinear, bicubic or lanczos3.", "filter", "lanczos3");
+    QCommandLineOption formatOption("format", "Output format: webp, png, jpg or bmp.", "format", "webp");
+    QCommandLineOption profileOption("profile", "WebP profile: fast, balanced, max or lossless.", "profile", "balanced");
+    QCommandLineOption qualityOption("quality", "WebP quality, 0-100.", "quality", "90");
+    QCommandLineOption threadsOption("threads", "Worker threads; 0 uses every core.", "count", "0");
+    parser.addOptions({batchOption, outputOption, resizeOption, filterOption, rotateOption, flipOption, cropOption,
+                       formatOption, profileOption, qualityOption, threadsOption});
+    parser.addPositionalArgument("inputs", "Image files or directories to process.", "<inputs...>");
+    parser.process(arguments);
+
+    auto usageError = [](const QString &message)
+    {
+        printLine(stderr, message);
+        return 2;
+    };
+
+    BatchOptions options;
+    options.inputs = parser.positionalArguments();
+    options.outputDirectory = parser.value(outputOption);
+    if (options.inputs.isEmpty() || options.outputDirectory.isEmpty())
+    {
+        return usageError("Usage: --batch --output <dir> [options] <inputs...>");
+    }
+
+    options.outputFormat = parser.value(formatOption).toLower();
+    if (!QStringList({"webp", "png", "jpg", "jpeg", "bmp"}).contains(options.outputFormat))
+    {
+        return usageError(QString("Unsupported output format %1").arg(options.outputFormat));
+    }
+    if (parser.isSet(resizeOption) && !parseSize(parser.value(resizeOption), &options.size))
+    {
+        return usageError("--resize expects WIDTHxHEIGHT");
+    }
+    if (!parseFilter(parser.value(filterOption), &options.filter))
+    {
+        return usageError("--filter expects box, bilinear, bicubic or lanczos3");
+    }
+    if (parser.isSet(cropOption) && !parseRect(parser.value(cropOption), &options.crop))
+    {
+        return usageError("--crop expects X,Y,WIDTH,HEIGHT");
+    }
+    if (parser.isSet(rotateOption))
+    {
+        bool ok = false;
+        int degrees = parser.value(rotateOption).toInt(&ok);
+        if (!ok || degrees % 90 != 0)
+        {
+            return usageError("--rotate expects a multiple of 90");
+        }
+        options.rotation = ((degrees % 360) + 360) % 360;
+    }
+    if (parser.isSet(flipOption))
+    {
+        QString axes = parser.value(flipOption).toLower();
+        if (axes.isEmpty() || axes.size() > 2 || !QString("hv").contains(axes.at(0)) || !QString("hv").contains(axes.back()))
+        {
+            return usageError("--flip expects h, v or hv");
+        }
+        if (axes.contains('h'))
+            options.flip |= Qt::Horizontal;
+        if (axes.contains('v'))
+            options.flip |= Qt::Vertical;
+    }
+    if (!parseProfile(parser.value(profileOption), &options.encode.profile))
+    {
+        return usageError("--profile expects fast, balanced, max or lossless");
+    }
+    bool qualityOk = false;
+    options.encode.quality = parser.value(qualityOption).toInt(&qualityOk);
+    if (!qualityOk || options.encode.quality < 0 || options.encode.quality > 100)
+    {
+        return usageError("--quality expects a value from 0 to 100");
+    }
+    options.threads = qMax(0, parser.value(threadsOption).toInt());
+
+    BatchProcessor processor(options);
+    return processor.run() == 0 ? 0 : 1;
+}
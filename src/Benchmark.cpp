@@ -0,0 +1,323 @@
+#include "Benchmark.hpp"
+#include "ImageLoader.hpp"
+#include "Resampler.hpp"
+#include "EditPipeline.hpp"
+#include <QtCore/QCommandLineParser>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFileInfo>
+#include <QtCore/QList>
+#include <QtCore/QPair>
+#include <QtCore/QTextStream>
+#include <QtCore/QThread>
+#include <QtGui/QImage>
+#include <QtGui/QTransform>
+#include <cstring>
+#include <functional>
+
+namespace
+{
+    void printLine(const QString &line)
+    {
+        QTextStream(stdout) << line << Qt::endl;
+    }
+
+    // Photo-like content: smooth gradients with fine detail, so filters do
+    // real work and nothing is constant enough to be skipped
+    QImage syntheticImage(const QSize &size)
+    {
+        QImage image(size, QImage::Format_RGB32);
+        quint32 noise = 0x9e3779b9u;
+        for (int y = 0; y < size.height(); ++y)
+        {
+            QRgb *row = reinterpret_cast<QRgb *>(image.scanLine(y));
+            for (int x = 0; x < size.width(); ++x)
+            {
+                noise = noise * 1664525u + 1013904223u;
+                int detail = static_cast<int>(noise >> 28);
+                row[x] = qRgb((x * 255 / size.width() + detail) & 0xff,
+                              (y * 255 / size.height() + detail) & 0xff,
+                              ((x ^ y) & 0xff));
+            }
+        }
+        return image;
+    }
+
+    // Best of repeat runs, in milliseconds
+    double bestTime(int repeat, const std::function<void()> &work)
+    {
+        double best = 0.0;
+        for (int i = 0; i < repeat; ++i)
+        {
+            QElapsedTimer timer;
+            timer.start();
+            work();
+            double ms = timer.nsecsElapsed() / 1e6;
+            best = i == 0 ? ms : qMin(best, ms);
+        }
+        return best;
+    }
+
+    // Pixels of result that differ from reference, with the first of them
+    // in *first; every pixel when the sizes or formats differ
+    qint64 countMismatches(const QImage &reference, const QImage &result, QPoint *first)
+    {
+        if (result.size() != reference.size() || result.format() != reference.format())
+        {
+            *first = QPoint(0, 0);
+            return static_cast<qint64>(reference.width()) * reference.height();
+        }
+        const int bytesPerPixel = qMax(1, reference.depth() / 8);
+        const size_t rowBytes = static_cast<size_t>(reference.width()) * bytesPerPixel;
+        qint64 mismatches = 0;
+        for (int y = 0; y < reference.height(); ++y)
+        {
+            const uchar *expected = reference.constScanLine(y);
+            const uchar *actual = result.constScanLine(y);
+            if (memcmp(expected, actual, rowBytes) == 0)
+            {
+                continue;
+            }
+            for (int x = 0; x < reference.width(); ++x)
+            {
+                if (memcmp(expected + x * bytesPerPixel, actual + x * bytesPerPixel, bytesPerPixel) != 0)
+                {
+                    if (mismatches++ == 0)
+                    {
+                        *first = QPoint(x, y);
+                    }
+                }
+            }
+        }
+        return mismatches;
+    }
+
+    // Returns whether every run matched the scalar output bit for bit
+    bool benchmarkResize(const QString &name, const QImage &image, const QSize &target, int repeat)
+    {
+        printLine(QString("%1: %2x%3 -> %4x%5")
+                      .arg(name)
+                      .arg(image.width())
+                      .arg(image.height())
+                      .arg(target.width())
+                      .arg(target.height()));
+
+        double baseline = bestTime(repeat, [&]()
+                                   { image.scaled(target, Qt::IgnoreAspectRatio, Qt::SmoothTransformation); });
+        printLine(QString("  %1 %2 ms").arg("QImage::scaled (smooth)", -36).arg(baseline, 8, 'f', 1));
+
+        // Scalar, the best instruction set, then the best across every core,
+        // all filtering at full width; then with box reduction where it applies
+        struct Run
+        {
+            SimdLevel simd;
+            int threads;
+            bool boxReduction;
+        };
+        const SimdLevel best = Resampler::supportedSimd();
+        const int cores = QThread::idealThreadCount();
+        QList<Run> runs{{SimdLevel::None, 1, false}};
+        if (best != SimdLevel::None)
+            runs.append({best, 1, false});
+        if (cores > 1)
+            runs.append({best, cores, false});
+        if (Resampler::reductionFactor(image.width(), target.width()) > 1 || Resampler::reductionFactor(image.height(), target.height()) > 1)
+            runs.append({best, cores, true});
+
+        // SIMD kernels and threading must not change a single byte, so each
+        // run is checked against the scalar output with the same box setting
+        bool identical = true;
+        for (ResampleFilter filter : Resampler::filters())
+        {
+            QImage scalar[2]; // Indexed by boxReduction
+            for (const Run &run : runs)
+            {
+                ResampleOptions options;
+                options.filter = filter;
+                options.maxSimd = run.simd;
+                options.threads = run.threads;
+                options.boxReduction = run.boxReduction;
+                QImage result;
+                double ms = bestTime(repeat, [&]()
+                                     { result = Resampler::resample(image, target, options); });
+                QString label = QString("%1 %2, %3 thread%4%5")
+                                    .arg(Resampler::filterName(filter), Resampler::simdName(run.simd))
+                                    .arg(run.threads)
+                                    .arg(run.threads == 1 ? "" : "s")
+                                    .arg(run.boxReduction ? ", box first" : "");
+                printLine(QString("  %1 %2 ms  %3x").arg(label, -36).arg(ms, 8, 'f', 1).arg(baseline / ms, 0, 'f', 2));
+
+                QImage &expected = scalar[run.boxReduction];
+                if (expected.isNull())
+                {
+                    ResampleOptions scalarOptions = options;
+                    scalarOptions.maxSimd = SimdLevel::None;
+                    expected = run.simd == SimdLevel::None ? result : Resampler::resample(image, target, scalarOptions);
+                }
+                QPoint first;
+                qint64 mismatches = countMismatches(expected, result, &first);
+                if (mismatches > 0)
+                {
+                    printLine(QString("    MISMATCH: %1 pixels differ from %2 scalar, first at %3,%4")
+                                  .arg(mismatches)
+                                  .arg(Resampler::filterName(filter))
+                                  .arg(first.x())
+                                  .arg(first.y()));
+                    identical = false;
+                }
+            }
+        }
+        return identical;
+    }
+
+    void benchmarkOrient(const QString &name, const QImage &image, int repeat)
+    {
+        printLine(QString("%1: %2x%3, %4-bit").arg(name).arg(image.width()).arg(image.height()).arg(image.depth()));
+
+        struct Operation
+        {
+            QString name;
+            Orientation orientation;
+            QTransform transform; // What QImage::transformed() is given for it
+        };
+        const QList<Operation> operations{
+            {QString("Rotate 90"), Orientation::rotation(90), QTransform().rotate(90)},
+            {QString("Rotate 180"), Orientation::rotation(180), QTransform().rotate(180)},
+            {QString("Rotate 270"), Orientation::rotation(270), QTransform().rotate(270)},
+            {QString("Flip horizontal"), Orientation::flip(Qt::Horizontal), QTransform::fromScale(-1, 1)},
+            {QString("Flip vertical"), Orientation::flip(Qt::Vertical), QTransform::fromScale(1, -1)},
+        };
+
+        const int cores = QThread::idealThreadCount();
+        for (const Operation &operation : operations)
+        {
+            double baseline = bestTime(repeat, [&]()
+                                       { image.transformed(operation.transform); });
+            auto report = [&](const QString &label, double ms)
+            {
+                printLine(QString("  %1 %2 ms  %3x").arg(label, -44).arg(ms, 8, 'f', 1).arg(baseline / ms, 0, 'f', 2));
+            };
+            printLine(QString("  %1 %2 ms").arg(operation.name + ", QImage::transformed", -44).arg(baseline, 8, 'f', 1));
+            report(operation.name + ", 1 thread", bestTime(repeat, [&]()
+                                                         { operation.orientation.apply(image, 1); }));
+            if (cores > 1)
+            {
+                report(QString("%1, %2 threads").arg(operation.name).arg(cores), bestTime(repeat, [&]()
+                                                                                         { operation.orientation.apply(image, cores); }));
+            }
+            if (!operation.orientation.swapsAxes())
+            {
+                // Repeated runs alternate between the two orientations, which
+                // costs the same
+                QImage buffer = image.copy();
+                report(QString("%1, in place, %2 thread%3").arg(operation.name).arg(cores).arg(cores == 1 ? "" : "s"),
+                       bestTime(repeat, [&]()
+                                { operation.orientation.applyInPlace(buffer, cores); }));
+            }
+        }
+    }
+
+    // Decoded inputs, or synthetic images of sizes when there are none
+    bool benchmarkImages(const QStringList &inputs, const QList<QSize> &sizes, QList<QPair<QString, QImage>> *images)
+    {
+        for (const QString &input : inputs)
+        {
+            QImage image = ImageLoader::loadImage(input);
+            if (image.isNull())
+            {
+                QTextStream(stderr) << "Could not decode " << input << Qt::endl;
+                return false;
+            }
+            images->append({QFileInfo(input).fileName(), image});
+        }
+        if (inputs.isEmpty())
+        {
+            for (const QSize &size : sizes)
+            {
+                images->append({QString("Synthetic %1x%2").arg(size.width()).arg(size.height()), syntheticImage(size)});
+            }
+        }
+        return true;
+    }
+}
+
+int Benchmark::exec(const QStringList &arguments)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Times the pixel engines against the Qt functions they replace.");
+    parser.addHelpOption();
+    QCommandLineOption benchmarkOption("benchmark", "Run the benchmark.");
+    QCommandLineOption scaleOption("scale", "Comma-separated resize factors; below 1 shrinks.", "factors", "0.333,0.1");
+    QCommandLineOption repeatOption("repeat", "Runs per measurement; the fastest counts.", "count", "3");
+    QCommandLineOption suiteOption("suite", "What to time: resize, orient or all.", "suite", "all");
+    parser.addOptions({benchmarkOption, scaleOption, repeatOption, suiteOption});
+    parser.addPositionalArgument("inputs", "Images to use instead of synthetic 4K-16K ones.", "[inputs...]");
+    parser.process(arguments);
+
+    QList<double> scales;
+    const QStringList scaleTexts = parser.value(scaleOption).split(',', Qt::SkipEmptyParts);
+    for (const QString &text : scaleTexts)
+    {
+        bool ok = false;
+        double scale = text.trimmed().toDouble(&ok);
+        if (!ok || scale <= 0.0 || scale > 8.0)
+        {
+            QTextStream(stderr) << "--scale expects factors above 0 and up to 8" << Qt::endl;
+            return 2;
+        }
+        scales.append(scale);
+    }
+    int repeat = qMax(1, parser.value(repeatOption).toInt());
+    const QString suite = parser.value(suiteOption).toLower();
+    if (!QStringList({"resize", "orient", "all"}).contains(suite))
+    {
+        QTextStream(stderr) << "--suite expects resize, orient or all" << Qt::endl;
+        return 2;
+    }
+
+    printLine(QString("SIMD: %1, %2 threads").arg(Resampler::simdName(Resampler::supportedSimd())).arg(QThread::idealThreadCount()));
+
+    const QStringList inputs = parser.positionalArguments();
+    bool identical = true;
+    if (suite != "orient")
+    {
+        QList<QPair<QString, QImage>> images;
+        if (!benchmarkImages(inputs, {QSize(3840, 2160), QSize(7680, 4320)}, &images))
+        {
+            return 1;
+        }
+        for (const auto &entry : images)
+        {
+            for (double scale : scales)
+            {
+                QSize target(qMax(1, qRound(entry.second.width() * scale)), qMax(1, qRound(entry.second.height() * scale)));
+                identical = benchmarkResize(entry.first, entry.second, target, repeat) && identical;
+            }
+        }
+    }
+    if (suite != "resize")
+    {
+        if (inputs.isEmpty())
+        {
+            // One at a time: the 16K image alone takes half a gigabyte
+            const QList<QSize> sizes{QSize(3840, 2160), QSize(7680, 4320), QSize(15360, 8640)};
+            for (const QSize &size : sizes)
+            {
+                benchmarkOrient(QString("Synthetic %1x%2").arg(size.width()).arg(size.height()), syntheticImage(size), repeat);
+            }
+        }
+        else
+        {
+            QList<QPair<QString, QImage>> images;
+            if (!benchmarkImages(inputs, {}, &images))
+            {
+                return 1;
+            }
+            for (const auto &entry : images)
+            {
+                benchmarkOrient(entry.first, entry.second, repeat);
+            }
+        }
+    }
+    // A resampler whose fast paths disagree with the scalar one fails the run
+    return identical ? 0 : 1;
+}
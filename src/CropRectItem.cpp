@@ -2,6 +2,8 @@
 #include <QtGui/QPainter>
 #include <QtWidgets/QGraphicsSceneMouseEvent>
 #include <QtWidgets/QApplication>
+#include <QtWidgets/QGraphicsScene>
+#include <QtWidgets/QGraphicsView>
 
 CropRectItem::CropRectItem(const QRectF &rect, QGraphicsItem *parent)
     : QGraphicsObject(parent), currentHandle(None), handleSize(8.0) // Size of the resize handles
@@ -17,10 +19,30 @@ CropRectItem::CropRectItem(const QRectF &rect, QGraphicsItem *parent)
     setPos(rect.topLeft());     // Set the item's position to the top-left of the rect
 }
 
+qreal CropRectItem::sceneHandleSize() const
+{
+    // The view zooms by transform, so keep the handles a constant size on screen
+    if (scene() && !scene()->views().isEmpty())
+    {
+        qreal viewScale = scene()->views().first()->transform().m11();
+        if (viewScale > 0)
+        {
+            return handleSize / viewScale;
+        }
+    }
+    return handleSize;
+}
+
+void CropRectItem::viewScaleChanged()
+{
+    prepareGeometryChange();
+    update();
+}
+
 QRectF CropRectItem::boundingRect() const
 {
     // Return the bounding rectangle including handles
-    qreal halfHandle = handleSize / 2.0;
+    qreal halfHandle = sceneHandleSize() / 2.0;
     return m_rect.adjusted(-halfHandle, -halfHandle, halfHandle, halfHandle);
 }
 
@@ -209,15 +231,20 @@ void CropRectItem::mouseReleaseEvent(QGraphicsSceneMouseEvent *event)
 
 void CropRectItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
 {
-    // Draw the rectangle itself
-    painter->setPen(QPen(Qt::white, 2, Qt::SolidLine));
+    // Draw the rectangle itself; cosmetic pens keep their width at any zoom
+    QPen outlinePen(Qt::white, 2, Qt::SolidLine);
+    outlinePen.setCosmetic(true);
+    painter->setPen(outlinePen);
     painter->setBrush(Qt::NoBrush);
     painter->drawRect(m_rect); // Draw member rectangle
 
     // Paint resize handles
     painter->setBrush(Qt::white);
-    painter->setPen(Qt::black);
+    QPen handlePen(Qt::black);
+    handlePen.setCosmetic(true);
+    painter->setPen(handlePen);
 
+    qreal handleSize = sceneHandleSize();
     qreal halfHandle = handleSize / 2.0;
 
     // Top-left
@@ -240,6 +267,7 @@ void CropRectItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *opti
 
 CropRectItem::HandleType CropRectItem::getHandleAt(const QPointF &pos)
 {
+    qreal handleSize = sceneHandleSize();
     qreal halfHandle = handleSize / 2.0;
     QRectF currentRect = m_rect; // Use member rectangle
 
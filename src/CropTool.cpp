@@ -1,5 +1,6 @@
 #include "CropTool.hpp"
 #include "ImageEditor.hpp" // Include ImageEditor to access its scene and image
+#include "TiledImage.hpp"
 #include <QtWidgets/QMessageBox>
 #include <QtGui/QImage>
 #include <QtWidgets/QGraphicsScene>
@@ -59,7 +60,7 @@ QWidget* CropTool::getToolWidget() {
         QHBoxLayout* widthLayout = new QHBoxLayout();
         m_widthLabel = new QLabel(tr("Width:"));
         m_widthSpinBox = new QSpinBox();
-        m_widthSpinBox->setRange(1, 10000); // Set appropriate range
+        m_widthSpinBox->setRange(1, TiledImage::MaxSide);
         widthLayout->addWidget(m_widthLabel);
         widthLayout->addWidget(m_widthSpinBox);
         cropLayout->addLayout(widthLayout);
@@ -67,7 +68,7 @@ QWidget* CropTool::getToolWidget() {
         QHBoxLayout* heightLayout = new QHBoxLayout();
         m_heightLabel = new QLabel(tr("Height:"));
         m_heightSpinBox = new QSpinBox();
-        m_heightSpinBox->setRange(1, 10000); // Set appropriate range
+        m_heightSpinBox->setRange(1, TiledImage::MaxSide);
         heightLayout->addWidget(m_heightLabel);
         heightLayout->addWidget(m_heightSpinBox);
         cropLayout->addLayout(heightLayout);
@@ -102,7 +103,7 @@ void CropTool::setImageEditor(ImageEditor* editor) {
 }
 
 void CropTool::startCrop() {
-    if (!m_editor || m_editor->getCurrentImage().isNull() || m_isCropping) {
+    if (!m_editor || !m_editor->hasImage() || m_isCropping) {
         return;
     }
 
@@ -130,6 +131,7 @@ void CropTool::startCrop() {
     connect(m_cropOverlay, &CropRectItem::yChanged, this, &CropTool::updateCropOverlaysFromItem);
     connect(m_cropOverlay, &CropRectItem::widthChanged, this, &CropTool::updateSpinBoxesFromCropRect);
     connect(m_cropOverlay, &CropRectItem::heightChanged, this, &CropTool::updateSpinBoxesFromCropRect);
+    connect(m_editor, &ImageEditor::zoomChanged, m_cropOverlay, &CropRectItem::viewScaleChanged);
 
     // Set initial aspect ratio state
     if (m_cropAspectRatioCheckBox) {
@@ -150,14 +152,10 @@ void CropTool::applyCrop() {
     qreal cropWidth = m_widthSpinBox->value();
     qreal cropHeight = m_heightSpinBox->value();
 
-    // The cropOverlay's position is in scene coordinates. We need to convert it to original image coordinates.
-    // The top-left corner of the crop overlay in scene coordinates.
-    QPointF cropTopLeftScene = m_cropOverlay->sceneBoundingRect().topLeft();
-    qreal currentZoomFactor = m_editor->getZoomFactor();
-
-    // Convert top-left corner to original image coordinates
-    int imageX = qRound(cropTopLeftScene.x() / currentZoomFactor);
-    int imageY = qRound(cropTopLeftScene.y() / currentZoomFactor);
+    // Zoom lives in the view transform, so scene coordinates are image coordinates
+    QPointF cropTopLeftScene = m_cropOverlay->mapRectToScene(m_cropOverlay->rect()).topLeft();
+    int imageX = qRound(cropTopLeftScene.x());
+    int imageY = qRound(cropTopLeftScene.y());
 
     QRect imageRect(
         imageX,
@@ -167,11 +165,11 @@ void CropTool::applyCrop() {
     );
     qDebug() << "Apply Crop: imageRect (original image coords) =" << imageRect;
 
-    QImage currentImage = m_editor->getCurrentImage();
-    qDebug() << "Apply Crop: currentImage dimensions =" << currentImage.width() << "x" << currentImage.height();
+    QSize currentSize = m_editor->getCurrentSize();
+    qDebug() << "Apply Crop: currentImage dimensions =" << currentSize.width() << "x" << currentSize.height();
 
     // Ensure the crop rectangle is within the bounds of the current image
-    imageRect = imageRect.intersected(currentImage.rect());
+    imageRect = imageRect.intersected(QRect(QPoint(0, 0), currentSize));
     qDebug() << "Apply Crop: imageRect (intersected) =" << imageRect;
 
     if (imageRect.isEmpty()) {
@@ -180,8 +178,8 @@ void CropTool::applyCrop() {
         return;
     }
 
-    currentImage = currentImage.copy(imageRect);
-    m_editor->setCurrentImage(currentImage); // Update the image in ImageEditor
+    // Recorded, not copied: the crop is applied together with any rotation or flip
+    m_editor->cropImage(imageRect);
     cancelCrop();
     m_editor->updateDisplay(); // Refresh the display
     qDebug() << "Apply Crop: Cropping applied successfully.";
@@ -220,7 +218,7 @@ void CropTool::updateCropOverlays() {
     
     QGraphicsScene* scene = m_editor->getGraphicsScene();
     QRectF sceneRect = scene->sceneRect();
-    QRectF rect = m_cropOverlay->sceneBoundingRect(); // Use sceneBoundingRect() to get the rect in scene coordinates
+    QRectF rect = m_cropOverlay->mapRectToScene(m_cropOverlay->rect()); // Crop rect in scene coordinates, without the handles
     
     // Ensure darkOverlays list is correctly sized
     if (m_darkOverlays.size() != 4) {
@@ -256,12 +254,10 @@ void CropTool::updateSpinBoxesFromCropRect() {
     m_widthSpinBox->blockSignals(true);
     m_heightSpinBox->blockSignals(true);
 
-    qreal currentZoomFactor = m_editor->getZoomFactor();
-    QRectF cropRectScene = m_cropOverlay->sceneBoundingRect();
-
-    // Convert scene dimensions to original image dimensions
-    m_widthSpinBox->setValue(qRound(cropRectScene.width() / currentZoomFactor));
-    m_heightSpinBox->setValue(qRound(cropRectScene.height() / currentZoomFactor));
+    // Scene dimensions are original image dimensions
+    QRectF cropRectScene = m_cropOverlay->mapRectToScene(m_cropOverlay->rect());
+    m_widthSpinBox->setValue(qRound(cropRectScene.width()));
+    m_heightSpinBox->setValue(qRound(cropRectScene.height()));
 
     m_widthSpinBox->blockSignals(false);
     m_heightSpinBox->blockSignals(false);
@@ -276,13 +272,11 @@ void CropTool::updateCropRectFromSpinBoxes() {
     qreal newWidthOriginal = m_widthSpinBox->value();
     qreal newHeightOriginal = m_heightSpinBox->value();
 
-    qreal currentZoomFactor = m_editor->getZoomFactor();
+    // Scene dimensions are original image dimensions
+    qreal newWidthScene = newWidthOriginal;
+    qreal newHeightScene = newHeightOriginal;
 
-    // Convert original image dimensions to scene dimensions
-    qreal newWidthScene = newWidthOriginal * currentZoomFactor;
-    qreal newHeightScene = newHeightOriginal * currentZoomFactor;
-
-    QRectF currentRectScene = m_cropOverlay->sceneBoundingRect();
+    QRectF currentRectScene = m_cropOverlay->mapRectToScene(m_cropOverlay->rect());
 
     if (m_cropAspectRatioCheckBox->isChecked()) {
         // Maintain aspect ratio based on original image dimensions
@@ -302,11 +296,12 @@ void CropTool::updateCropRectFromSpinBoxes() {
         }
     }
 
-    // Update the CropRectItem's rectangle in scene coordinates
+    // Update the CropRectItem's rectangle (item coordinates, scale 1:1 with the scene)
     // Keep the top-left corner fixed for now, or adjust based on desired behavior
-    m_cropOverlay->setRect(QRectF(currentRectScene.topLeft(), QSizeF(newWidthScene, newHeightScene)));
+    m_cropOverlay->setRect(QRectF(m_cropOverlay->rect().topLeft(), QSizeF(newWidthScene, newHeightScene)));
 
     m_cropOverlay->blockSignals(false);
 
     updateCropOverlays(); // Update dark overlays after rect change
 }
+
@@ -0,0 +1,83 @@
+#include "EditHistory.hpp"
+
+namespace
+{
+    // Bookkeeping cost of an entry; the pipeline itself is a few fields
+    const qint64 EntryCost = 256;
+}
+
+EditHistory::EditHistory(QObject *parent)
+    : QObject(parent), m_memoryBudget(DefaultMemoryBudget)
+{
+}
+
+EditHistory::~EditHistory() = default;
+
+void EditHistory::setMemoryBudget(qint64 bytes)
+{
+    m_memoryBudget = qMax<qint64>(0, bytes);
+    enforceBudget();
+    emit changed();
+}
+
+qint64 EditHistory::memoryUsed() const
+{
+    return (m_undo.size() + m_redo.size()) * EntryCost;
+}
+
+void EditHistory::recordEdits(const EditPipeline &before)
+{
+    m_undo.append(before);
+    m_redo.clear();
+    enforceBudget();
+    emit changed();
+}
+
+bool EditHistory::undo(EditPipeline *edits)
+{
+    return step(m_undo, m_redo, edits);
+}
+
+bool EditHistory::redo(EditPipeline *edits)
+{
+    return step(m_redo, m_undo, edits);
+}
+
+void EditHistory::clear()
+{
+    m_undo.clear();
+    m_redo.clear();
+    emit changed();
+}
+
+bool EditHistory::step(QList<EditPipeline> &from, QList<EditPipeline> &to, EditPipeline *edits)
+{
+    if (from.isEmpty())
+    {
+        return false;
+    }
+    // The current pipeline goes onto the other stack
+    to.append(*edits);
+    *edits = from.takeLast();
+    emit changed();
+    return true;
+}
+
+void EditHistory::enforceBudget()
+{
+    while (memoryUsed() > m_memoryBudget)
+    {
+        if (!m_undo.isEmpty())
+        {
+            m_undo.removeFirst();
+        }
+        else if (!m_redo.isEmpty())
+        {
+            m_redo.removeFirst();
+        }
+        else
+        {
+            break;
+        }
+    }
+}
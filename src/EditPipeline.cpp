@@ -0,0 +1,474 @@
+#include "EditPipeline.hpp"
+#include "RowBands.hpp"
+#include <QtCore/QPointF>
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+namespace
+{
+    struct Pixel24
+    {
+        uchar bytes[3];
+    };
+    static_assert(sizeof(Pixel24) == 3, "24-bit pixels must be packed");
+
+    // Rotations are copied in square tiles of this many pixels, so the rows
+    // a tile reads and the columns it writes both stay in cache
+    constexpr int TileSize = 64;
+    // Smallest band of rows worth handing to another thread
+    constexpr int MinBandRows = 16;
+
+    // Copies sourceRect of source into target, where t maps sourceRect's
+    // local coordinates to target's. t is one of the eight orientations, so
+    // it maps pixel indices to pixel indices with integer steps and each
+    // output pixel is written exactly once. Bands of rows (or of tiles, when
+    // rows become columns) run in parallel.
+    template <typename Pixel>
+    void remapPixels(const QImage &source, const QRect &sourceRect, QImage &target, const QTransform &t, int threads)
+    {
+        const qsizetype pixelBytes = sizeof(Pixel);
+        const qsizetype stride = target.bytesPerLine();
+        const qsizetype stepX = qRound(t.m11()) * pixelBytes + qRound(t.m12()) * stride;
+        const qsizetype stepY = qRound(t.m21()) * pixelBytes + qRound(t.m22()) * stride;
+
+        // Target index of the first source pixel, mapped through its center
+        QPointF origin = t.map(QPointF(0.5, 0.5)) - QPointF(0.5, 0.5);
+        uchar *rowStart = target.bits() + qRound(origin.y()) * stride + qRound(origin.x()) * pixelBytes;
+
+        const uchar *sourceBits = source.constBits() + sourceRect.x() * pixelBytes;
+        const qsizetype sourceStride = source.bytesPerLine();
+        const int width = sourceRect.width();
+        const int height = sourceRect.height();
+        auto sourceRow = [&](int y)
+        { return reinterpret_cast<const Pixel *>(sourceBits + (sourceRect.y() + y) * sourceStride); };
+
+        if (stepX == pixelBytes || stepX == -pixelBytes)
+        {
+            // Rows stay rows: straight or reversed copies
+            forEachRowBand(height, threads, MinBandRows, [&](int begin, int end)
+                           {
+                for (int y = begin; y < end; ++y)
+                {
+                    const Pixel *in = sourceRow(y);
+                    Pixel *out = reinterpret_cast<Pixel *>(rowStart + y * stepY);
+                    if (stepX > 0)
+                    {
+                        std::memcpy(out, in, width * pixelBytes);
+                    }
+                    else
+                    {
+                        std::reverse_copy(in, in + width, out - (width - 1));
+                    }
+                } });
+            return;
+        }
+
+        // Rows become columns: transpose tile by tile
+        const int tileRows = (height + TileSize - 1) / TileSize;
+        forEachRowBand(tileRows, threads, 1, [&](int begin, int end)
+                       {
+            for (int tileY = begin * TileSize; tileY < qMin(end * TileSize, height); tileY += TileSize)
+            {
+                const int tileBottom = qMin(tileY + TileSize, height);
+                for (int tileX = 0; tileX < width; tileX += TileSize)
+                {
+                    const int tileRight = qMin(tileX + TileSize, width);
+                    for (int y = tileY; y < tileBottom; ++y)
+                    {
+                        const Pixel *in = sourceRow(y);
+                        uchar *out = rowStart + y * stepY + tileX * stepX;
+                        for (int x = tileX; x < tileRight; ++x)
+                        {
+                            *reinterpret_cast<Pixel *>(out) = in[x];
+                            out += stepX;
+                        }
+                    }
+                }
+            } });
+    }
+
+    // 180 degrees and flips keep every pixel in its row pair, so they can
+    // swap pixels within the image's own buffer
+    template <typename Pixel>
+    void orientPixelsInPlace(QImage &image, const Orientation &orientation, int threads)
+    {
+        // A mirror alone reverses rows; half a turn also reverses their
+        // order, which undoes the reversal for a mirrored half turn
+        const bool swapRows = orientation.quarterTurns() == 2;
+        const bool reverseRows = swapRows != orientation.isMirrored();
+        const int width = image.width();
+        const int height = image.height();
+        uchar *bits = image.bits();
+        const qsizetype stride = image.bytesPerLine();
+        auto row = [&](int y)
+        { return reinterpret_cast<Pixel *>(bits + y * stride); };
+
+        if (!swapRows)
+        {
+            forEachRowBand(height, threads, MinBandRows, [&](int begin, int end)
+                           {
+                for (int y = begin; y < end; ++y)
+                {
+                    std::reverse(row(y), row(y) + width);
+                } });
+            return;
+        }
+
+        forEachRowBand(height / 2, threads, MinBandRows, [&](int begin, int end)
+                       {
+            for (int y = begin; y < end; ++y)
+            {
+                Pixel *top = row(y);
+                Pixel *bottom = row(height - 1 - y);
+                if (reverseRows)
+                {
+                    for (int x = 0; x < width; ++x)
+                    {
+                        std::swap(top[x], bottom[width - 1 - x]);
+                    }
+                }
+                else
+                {
+                    std::swap_ranges(top, top + width, bottom);
+                }
+            } });
+        if (reverseRows && height % 2 != 0)
+        {
+            std::reverse(row(height / 2), row(height / 2) + width);
+        }
+    }
+
+    // Copies sourceRect of source, oriented, in a single pass
+    QImage orientRegion(const QImage &source, const QRect &sourceRect, const Orientation &orientation, int threads)
+    {
+        if (orientation.isIdentity())
+        {
+            return EditPipeline::regionView(source, sourceRect);
+        }
+
+        QTransform t = orientation.transform(sourceRect.size());
+        if (source.depth() < 8)
+        {
+            // Bit-packed formats: rare enough to go through Qt's per-step paths
+            return source.copy(sourceRect).transformed(t);
+        }
+
+        QImage target(orientation.mapSize(sourceRect.size()), source.format());
+        if (target.isNull())
+        {
+            return QImage();
+        }
+        target.setColorTable(source.colorTable());
+        target.setDotsPerMeterX(orientation.swapsAxes() ? source.dotsPerMeterY() : source.dotsPerMeterX());
+        target.setDotsPerMeterY(orientation.swapsAxes() ? source.dotsPerMeterX() : source.dotsPerMeterY());
+
+        switch (source.depth())
+        {
+        case 8:
+            remapPixels<quint8>(source, sourceRect, target, t, threads);
+            break;
+        case 16:
+            remapPixels<quint16>(source, sourceRect, target, t, threads);
+            break;
+        case 24:
+            remapPixels<Pixel24>(source, sourceRect, target, t, threads);
+            break;
+        case 32:
+            remapPixels<quint32>(source, sourceRect, target, t, threads);
+            break;
+        case 64:
+            remapPixels<quint64>(source, sourceRect, target, t, threads);
+            break;
+        default:
+            return source.copy(sourceRect).transformed(t); // 48/96/128-bit formats
+        }
+        return target;
+    }
+}
+
+Orientation Orientation::rotation(int degrees)
+{
+    return Orientation(degrees / 90, false);
+}
+
+Orientation Orientation::flip(Qt::Orientations orientations)
+{
+    bool horizontal = orientations.testFlag(Qt::Horizontal);
+    bool vertical = orientations.testFlag(Qt::Vertical);
+    if (horizontal && vertical)
+    {
+        return Orientation(2, false);
+    }
+    if (vertical)
+    {
+        return Orientation(2, true); // Mirror, then half a turn
+    }
+    return Orientation(0, horizontal);
+}
+
+Orientation Orientation::then(const Orientation &next) const
+{
+    // A mirror reverses the direction of the turns it is moved across
+    int turns = next.m_quarterTurns + (next.m_mirrored ? -m_quarterTurns : m_quarterTurns);
+    return Orientation(turns, m_mirrored != next.m_mirrored);
+}
+
+Orientation Orientation::inverted() const
+{
+    return Orientation(m_mirrored ? m_quarterTurns : -m_quarterTurns, m_mirrored);
+}
+
+QSize Orientation::mapSize(const QSize &size) const
+{
+    return swapsAxes() ? size.transposed() : size;
+}
+
+QRect Orientation::mapRect(const QRect &rect, const QSize &sourceSize) const
+{
+    return transform(sourceSize).mapRect(QRectF(rect)).toRect();
+}
+
+QTransform Orientation::transform(const QSize &sourceSize) const
+{
+    QTransform t;
+    QSize size = sourceSize;
+    if (m_mirrored)
+    {
+        t = QTransform(-1, 0, 0, 1, size.width(), 0);
+    }
+    for (int i = 0; i < m_quarterTurns; ++i)
+    {
+        // (x, y) -> (height - y, x), a clockwise quarter turn
+        t = t * QTransform(0, 1, -1, 0, size.height(), 0);
+        size.transpose();
+    }
+    return t;
+}
+
+QImage Orientation::apply(const QImage &image, int threads) const
+{
+    EditPipeline pipeline(image.size());
+    pipeline.orient(*this);
+    return pipeline.apply(image, threads);
+}
+
+QImage Orientation::apply(QImage &&image, int threads) const
+{
+    // In place only pays off when nobody else shares the buffer; otherwise
+    // detaching would copy it first
+    if (image.isDetached() && applyInPlace(image, threads))
+    {
+        return std::move(image);
+    }
+    return apply(static_cast<const QImage &>(image), threads);
+}
+
+bool Orientation::applyInPlace(QImage &image, int threads) const
+{
+    if (isIdentity())
+    {
+        return true;
+    }
+    if (swapsAxes() || image.isNull())
+    {
+        return false;
+    }
+    switch (image.depth())
+    {
+    case 8:
+        orientPixelsInPlace<quint8>(image, *this, threads);
+        return true;
+    case 16:
+        orientPixelsInPlace<quint16>(image, *this, threads);
+        return true;
+    case 24:
+        orientPixelsInPlace<Pixel24>(image, *this, threads);
+        return true;
+    case 32:
+        orientPixelsInPlace<quint32>(image, *this, threads);
+        return true;
+    case 64:
+        orientPixelsInPlace<quint64>(image, *this, threads);
+        return true;
+    default:
+        return false;
+    }
+}
+
+EditPipeline::EditPipeline(const QSize &sourceSize)
+    : m_sourceSize(sourceSize), m_sourceRect(QPoint(0, 0), sourceSize)
+{
+}
+
+bool EditPipeline::crop(const QRect &rect)
+{
+    QSize size = outputSize();
+    QRect clipped = rect.intersected(QRect(QPoint(0, 0), size));
+    if (clipped.isEmpty())
+    {
+        return false;
+    }
+
+    // Undo the resize first; the crop then covers whole source pixels
+    QSize oriented = orientedSize();
+    QRect unscaled = clipped;
+    if (isScaled())
+    {
+        qreal sx = static_cast<qreal>(oriented.width()) / size.width();
+        qreal sy = static_cast<qreal>(oriented.height()) / size.height();
+        unscaled = QRect(qRound(clipped.x() * sx), qRound(clipped.y() * sy),
+                         qMax(1, qRound(clipped.width() * sx)), qMax(1, qRound(clipped.height() * sy)))
+                       .intersected(QRect(QPoint(0, 0), oriented));
+        if (unscaled.isEmpty())
+        {
+            return false;
+        }
+    }
+
+    // Back through the orientation into the current source crop
+    QRect local = m_orientation.inverted().mapRect(unscaled, oriented);
+    m_sourceRect = local.translated(m_sourceRect.topLeft());
+    if (isScaled())
+    {
+        resize(clipped.size(), m_filter);
+    }
+    return true;
+}
+
+void EditPipeline::orient(const Orientation &orientation)
+{
+    m_orientation = m_orientation.then(orientation);
+    if (isScaled())
+    {
+        m_scaledSize = orientation.mapSize(m_scaledSize); // Scaling commutes with orienting
+    }
+}
+
+void EditPipeline::resize(const QSize &size, ResampleFilter filter)
+{
+    if (size.isEmpty())
+    {
+        return;
+    }
+    m_filter = filter;
+    // Always from the unscaled crop, so repeated resizes resample only once
+    m_scaledSize = size == orientedSize() ? QSize() : size;
+}
+
+bool EditPipeline::isIdentity() const
+{
+    return m_orientation.isIdentity() && !isScaled() && m_sourceRect == QRect(QPoint(0, 0), m_sourceSize);
+}
+
+QTransform EditPipeline::transform() const
+{
+    QTransform t = QTransform::fromTranslate(-m_sourceRect.x(), -m_sourceRect.y()) * m_orientation.transform(m_sourceRect.size());
+    if (isScaled())
+    {
+        QSize oriented = orientedSize();
+        t *= QTransform::fromScale(static_cast<qreal>(m_scaledSize.width()) / oriented.width(),
+                                   static_cast<qreal>(m_scaledSize.height()) / oriented.height());
+    }
+    return t;
+}
+
+QImage EditPipeline::apply(const QImage &source, int threads) const
+{
+    if (source.isNull() || isIdentity())
+    {
+        return source;
+    }
+    if (!isScaled())
+    {
+        return orientRegion(source, m_sourceRect, m_orientation, threads);
+    }
+
+    // Orient whichever side of the resample has fewer pixels
+    QSize output = outputSize();
+    if (qint64(output.width()) * output.height() < qint64(m_sourceRect.width()) * m_sourceRect.height())
+    {
+        QSize scaledSource = m_orientation.inverted().mapSize(output);
+        QImage scaled = Resampler::resample(regionView(source, m_sourceRect), scaledSource, resampleOptions(threads));
+        return m_orientation.apply(std::move(scaled), threads);
+    }
+    QImage oriented = orientRegion(source, m_sourceRect, m_orientation, threads);
+    return Resampler::resample(oriented, output, resampleOptions(threads));
+}
+
+QImage EditPipeline::apply(QImage &&source, int threads) const
+{
+    // Shared buffers must stay as they are, and bit-packed rows cannot be
+    // cut at arbitrary pixels
+    if (source.isNull() || isIdentity() || !source.isDetached() || source.depth() < 8)
+    {
+        return apply(static_cast<const QImage &>(source), threads);
+    }
+    QImage cropped = regionView(std::move(source), m_sourceRect);
+    if (!isScaled())
+    {
+        return m_orientation.apply(std::move(cropped), threads);
+    }
+
+    QSize output = outputSize();
+    if (qint64(output.width()) * output.height() < qint64(m_sourceRect.width()) * m_sourceRect.height())
+    {
+        QSize scaledSource = m_orientation.inverted().mapSize(output);
+        QImage scaled = Resampler::resample(cropped, scaledSource, resampleOptions(threads));
+        cropped = QImage(); // Frees the source before orienting
+        return m_orientation.apply(std::move(scaled), threads);
+    }
+    return Resampler::resample(m_orientation.apply(std::move(cropped), threads), output, resampleOptions(threads));
+}
+
+QImage EditPipeline::regionView(const QImage &image, const QRect &rect)
+{
+    if (rect == image.rect())
+    {
+        return image;
+    }
+    if (image.depth() < 8)
+    {
+        return image.copy(rect); // Rows of bit-packed formats cannot start mid-byte
+    }
+    // The view holds a reference to image, so the buffer outlives it and
+    // image's owner detaches before writing to it
+    const uchar *origin = image.constScanLine(rect.y()) + rect.x() * (image.depth() / 8);
+    QImage view(origin, rect.width(), rect.height(), image.bytesPerLine(), image.format(), [](void *info)
+                { delete static_cast<QImage *>(info); }, new QImage(image));
+    view.setColorTable(image.colorTable());
+    view.setDotsPerMeterX(image.dotsPerMeterX());
+    view.setDotsPerMeterY(image.dotsPerMeterY());
+    view.setColorSpace(image.colorSpace());
+    return view;
+}
+
+QImage EditPipeline::regionView(QImage &&image, const QRect &rect)
+{
+    if (rect == image.rect())
+    {
+        return std::move(image);
+    }
+    if (!image.isDetached() || image.depth() < 8)
+    {
+        return regionView(static_cast<const QImage &>(image), rect);
+    }
+    // The view owns the whole buffer, which is freed with it
+    QImage *owner = new QImage(std::move(image));
+    uchar *origin = owner->scanLine(rect.y()) + rect.x() * (owner->depth() / 8);
+    QImage view(origin, rect.width(), rect.height(), owner->bytesPerLine(), owner->format(), [](void *info)
+                { delete static_cast<QImage *>(info); }, owner);
+    view.setColorTable(owner->colorTable());
+    view.setDotsPerMeterX(owner->dotsPerMeterX());
+    view.setDotsPerMeterY(owner->dotsPerMeterY());
+    view.setColorSpace(owner->colorSpace());
+    return view;
+}
+
+ResampleOptions EditPipeline::resampleOptions(int threads) const
+{
+    ResampleOptions options;
+    options.filter = m_filter;
+    options.threads = threads;
+    return options;
+}
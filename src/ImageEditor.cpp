@@ -10,7 +10,6 @@
 #include <QtGui/QImageReader>
 #include <QtGui/QImageWriter>
 #include <QtCore/QStandardPaths>
-#include <QtWidgets/QGraphicsPixmapItem>
 #include <QtGui/QTransform>
 #include <QtWidgets/QDialogButtonBox>
 #include <QtWidgets/QCheckBox>
@@ -20,17 +19,32 @@
 #include <QtWidgets/QGroupBox>
 #include <QtGui/QMouseEvent>
 #include "CropRectItem.hpp"
+#include "TiledImageItem.hpp"
+#include "ImagePyramid.hpp"
 #include "CropTool.hpp"
 #include "OpenSaveTool.hpp"
 #include "ResizeTool.hpp"
 #include "RotateFlipTool.hpp"
 #include "ZoomTool.hpp"
+#include "EditHistory.hpp"
+#include "ThumbnailStrip.hpp"
+#include "TiledImage.hpp"
+#include <QtWidgets/QMenu>
+#include <QtWidgets/QInputDialog>
+#include <QtGui/QAction>
+#include <QtGui/QKeySequence>
 
 ImageEditor::ImageEditor(QWidget *parent)
-    : QMainWindow(parent), scene(new QGraphicsScene(this)), view(new QGraphicsView(scene)), toolsDock(new QDockWidget(tr("Tools"), this)), zoomFactor(1.0)
+    : QMainWindow(parent), scene(new QGraphicsScene(this)), view(new QGraphicsView(scene)), toolsDock(new QDockWidget(tr("Tools"), this)), thumbnailDock(new QDockWidget(tr("Folder"), this)), m_thumbnailStrip(new ThumbnailStrip()), m_imageItem(new TiledImageItem()), m_pyramid(new ImagePyramid(this)), m_showingPreview(false), m_showingScaledPreview(false), zoomFactor(1.0), m_history(new EditHistory(this))
 
 {
+    scene->addItem(m_imageItem); // Persistent; the scene owns it from here on
+    m_imageItem->setPyramid(m_pyramid);
+    connect(m_pyramid, &ImagePyramid::levelsUpdated, this, [this](const QRect &dirtyRect)
+            { m_imageItem->pyramidUpdated(dirtyRect); });
     setupUI();
+    setupEditMenu();
+    setupThumbnailDock();
     setupToolsDock();
 
     setCentralWidget(view);
@@ -59,24 +73,247 @@ void ImageEditor::updateDisplay()
 {
     if (currentImage.isNull())
     {
+        if (m_showingPreview)
+        {
+            m_imageItem->setImage(QImage()); // Drop a preview of a load that failed
+            m_showingPreview = false;
+            m_showingScaledPreview = false;
+        }
         return;
     }
 
-    scene->clear();
+    // The same image keeps its tiles and pyramid levels; a new one is
+    // rasterized only where visible, with the levels built in the background
+    m_pyramid->setBaseImage(currentImage);
+    m_imageItem->setImage(currentImage);
+    m_showingPreview = false;
+    m_showingScaledPreview = false;
 
-    // Scale image according to zoom factor
-    QSize newSize = calculateZoomedSize();
-    QGraphicsPixmapItem *item = scene->addPixmap(QPixmap::fromImage(currentImage.scaled(newSize, Qt::KeepAspectRatio, Qt::SmoothTransformation)));
+    // Pending edits are shown by the item transform, so the existing tiles
+    // and pyramid levels act as the preview proxy; scene coordinates stay
+    // current (edited) image pixels
+    QRect sourceRect = m_pendingEdits.sourceRect();
+    QTransform transform = m_pendingEdits.transform();
+    if (m_tiledSource)
+    {
+        // The item shows the overview scaled up to the tiled image's size,
+        // and its tiles when zoomed in far enough
+        QTransform toSource = QTransform::fromScale(qreal(m_tiledSource->size().width()) / currentImage.width(),
+                                                    qreal(m_tiledSource->size().height()) / currentImage.height());
+        sourceRect = sourceRect == m_tiledSource->rect() ? currentImage.rect() : toSource.inverted().mapRect(QRectF(sourceRect)).toAlignedRect().intersected(currentImage.rect());
+        transform = toSource * transform;
+    }
+    m_imageItem->setDetailSource(m_tiledSource);
+    m_imageItem->setSourceRect(sourceRect == currentImage.rect() ? QRect() : sourceRect);
+    m_imageItem->setTransform(transform);
 
-    // Center the image
-    scene->setSceneRect(item->boundingRect());
-    view->setSceneRect(item->boundingRect());
-    view->centerOn(item);
+    centerImage();
 
     // Update window title
     updateTitle();
 }
 
+void ImageEditor::centerImage()
+{
+    QRectF bounds = m_imageItem->mapRectToScene(m_imageItem->boundingRect());
+    scene->setSceneRect(bounds);
+    view->setSceneRect(bounds);
+    view->centerOn(m_imageItem);
+}
+
+void ImageEditor::showPreviewRows(const QImage &rows, int firstRow, const QSize &fullSize)
+{
+    if (m_showingScaledPreview)
+    {
+        return; // The whole image is on screen already
+    }
+    if (!m_showingPreview || m_imageItem->image().size() != fullSize)
+    {
+        // Fresh canvas the rows are written into as they arrive
+        QImage canvas(fullSize, QImage::Format_ARGB32_Premultiplied);
+        if (canvas.isNull())
+        {
+            return;
+        }
+        canvas.fill(Qt::transparent);
+        m_imageItem->setImage(canvas);
+        m_imageItem->setSourceRect(QRect());
+        m_imageItem->setTransform(QTransform());
+        m_showingPreview = true;
+        centerImage();
+    }
+    m_imageItem->writeRows(rows, firstRow);
+}
+
+void ImageEditor::showScaledPreview(const QImage &preview, const QSize &fullSize)
+{
+    if (preview.isNull() || fullSize.isEmpty())
+    {
+        return;
+    }
+    // Scene coordinates stay full-size image pixels; the item scales up
+    m_imageItem->setImage(preview);
+    m_imageItem->setSourceRect(QRect());
+    m_imageItem->setTransform(QTransform::fromScale(qreal(fullSize.width()) / preview.width(),
+                                                    qreal(fullSize.height()) / preview.height()));
+    m_showingPreview = true;
+    m_showingScaledPreview = true;
+    centerImage();
+}
+
+void ImageEditor::setZoomFactor(qreal factor)
+{
+    zoomFactor = factor;
+    view->setTransform(QTransform::fromScale(zoomFactor, zoomFactor));
+    emit zoomChanged(zoomFactor);
+}
+
+void ImageEditor::setDocumentImage(const QImage &image)
+{
+    m_history->clear();
+    replaceImage(image);
+    emit imageChanged();
+}
+
+void ImageEditor::setTiledDocument(const std::shared_ptr<TiledImage> &source, const QImage &overview)
+{
+    m_history->clear();
+    replaceImage(overview);
+    m_pendingEdits = EditPipeline(source->size()); // Edits address the tiled pixels
+    m_tiledSource = source;
+    emit imageChanged();
+}
+
+void ImageEditor::replaceImage(const QImage &image)
+{
+    currentImage = image;
+    m_pendingEdits = EditPipeline(image.size());
+    m_tiledSource.reset(); // Whatever replaces the pixels is an ordinary image
+}
+
+void ImageEditor::orientImage(const Orientation &orientation)
+{
+    if (currentImage.isNull())
+    {
+        return;
+    }
+    m_history->recordEdits(m_pendingEdits);
+    m_pendingEdits.orient(orientation);
+    emit imageChanged();
+}
+
+bool ImageEditor::cropImage(const QRect &rect)
+{
+    EditPipeline edits = m_pendingEdits;
+    if (currentImage.isNull() || !edits.crop(rect))
+    {
+        return false;
+    }
+    m_history->recordEdits(m_pendingEdits);
+    m_pendingEdits = edits;
+    emit imageChanged();
+    return true;
+}
+
+void ImageEditor::resizeImage(const QSize &size, ResampleFilter filter)
+{
+    if (currentImage.isNull() || size.isEmpty())
+    {
+        return;
+    }
+    if (size == m_pendingEdits.outputSize() && (!m_pendingEdits.isScaled() || filter == m_pendingEdits.filter()))
+    {
+        return;
+    }
+    m_history->recordEdits(m_pendingEdits);
+    m_pendingEdits.resize(size, filter);
+    emit imageChanged();
+}
+
+void ImageEditor::undo()
+{
+    EditPipeline edits = m_pendingEdits;
+    if (m_history->undo(&edits))
+    {
+        restoreEdits(edits);
+    }
+}
+
+void ImageEditor::redo()
+{
+    EditPipeline edits = m_pendingEdits;
+    if (m_history->redo(&edits))
+    {
+        restoreEdits(edits);
+    }
+}
+
+void ImageEditor::restoreEdits(const EditPipeline &edits)
+{
+    // The source pixels are the same, so the display keeps its tiles and
+    // only its transform changes
+    m_pendingEdits = edits;
+    updateDisplay();
+    emit imageChanged();
+}
+
+void ImageEditor::setHistoryBudget()
+{
+    bool ok = false;
+    int megabytes = QInputDialog::getInt(this, tr("Undo History"), tr("Memory limit (MiB):"),
+                                         static_cast<int>(m_history->memoryBudget() / (1024 * 1024)), 0, 1024 * 1024, 64, &ok);
+    if (ok)
+    {
+        m_history->setMemoryBudget(static_cast<qint64>(megabytes) * 1024 * 1024);
+    }
+}
+
+void ImageEditor::setScratchDirectory()
+{
+    // Applies to images opened from now on; open ones keep their file
+    QString directory = QFileDialog::getExistingDirectory(this, tr("Scratch Folder for Large Images"), TiledImage::scratchDirectory());
+    if (!directory.isEmpty())
+    {
+        TiledImage::setScratchDirectory(directory);
+    }
+}
+
+void ImageEditor::setupEditMenu()
+{
+    QMenu *editMenu = menuBar()->addMenu(tr("&Edit"));
+
+    QAction *undoAction = editMenu->addAction(tr("&Undo"));
+    undoAction->setShortcut(QKeySequence::Undo);
+    connect(undoAction, &QAction::triggered, this, &ImageEditor::undo);
+
+    QAction *redoAction = editMenu->addAction(tr("&Redo"));
+    redoAction->setShortcut(QKeySequence::Redo);
+    connect(redoAction, &QAction::triggered, this, &ImageEditor::redo);
+
+    editMenu->addSeparator();
+    QAction *budgetAction = editMenu->addAction(tr("History &Memory Limit..."));
+    connect(budgetAction, &QAction::triggered, this, &ImageEditor::setHistoryBudget);
+    QAction *scratchAction = editMenu->addAction(tr("&Scratch Folder..."));
+    connect(scratchAction, &QAction::triggered, this, &ImageEditor::setScratchDirectory);
+
+    auto updateActions = [this, undoAction, redoAction]()
+    {
+        undoAction->setEnabled(m_history->canUndo());
+        redoAction->setEnabled(m_history->canRedo());
+    };
+    connect(m_history, &EditHistory::changed, this, updateActions);
+    updateActions();
+}
+
+void ImageEditor::setCurrentFilePath(const QString &path)
+{
+    if (path != m_currentFilePath)
+    {
+        m_currentFilePath = path;
+        emit currentFileChanged(path);
+    }
+}
+
 void ImageEditor::updateTitle()
 {
     QString title = tr("EZ Image Manipulator");
@@ -87,13 +324,6 @@ void ImageEditor::updateTitle()
     setWindowTitle(title);
 }
 
-QSize ImageEditor::calculateZoomedSize() const
-{
-    return QSize(
-        qRound(currentImage.width() * zoomFactor),
-        qRound(currentImage.height() * zoomFactor));
-}
-
 void ImageEditor::setupToolsDock()
 {
     QWidget *toolsWidget = new QWidget(toolsDock);
@@ -105,6 +335,12 @@ void ImageEditor::setupToolsDock()
     openSaveTool->setImageEditor(this);
     mainLayout->addWidget(openSaveTool->getToolWidget());
     m_imageTools.append(openSaveTool);
+    connect(m_thumbnailStrip, &ThumbnailStrip::fileActivated, openSaveTool, [this, openSaveTool](const QString &fileName)
+            {
+        if (!openSaveTool->openFile(fileName) && !m_currentFilePath.isEmpty())
+        {
+            m_thumbnailStrip->showFolderOf(m_currentFilePath); // Kept the open image; mark it again
+        } });
 
     mainLayout->addSpacing(10); // Add some space after the main action buttons
 
@@ -138,4 +374,18 @@ void ImageEditor::setupToolsDock()
     toolsDock->setWidget(toolsWidget);
     toolsDock->setFeatures(QDockWidget::NoDockWidgetFeatures); // Disable close button and other features
     addDockWidget(Qt::RightDockWidgetArea, toolsDock);
+}
+
+void ImageEditor::setupThumbnailDock()
+{
+    // Follows the open (or last saved) file to its folder
+    connect(this, &ImageEditor::currentFileChanged, m_thumbnailStrip, [this](const QString &path)
+            {
+        if (!path.isEmpty())
+        {
+            m_thumbnailStrip->showFolderOf(path);
+        } });
+    thumbnailDock->setWidget(m_thumbnailStrip);
+    thumbnailDock->setFeatures(QDockWidget::NoDockWidgetFeatures);
+    addDockWidget(Qt::BottomDockWidgetArea, thumbnailDock);
 }
\ No newline at end of file
@@ -0,0 +1,473 @@
+#include "ImageLoader.hpp"
+#include "WebPHandler.hpp"
+#include "EditPipeline.hpp"
+#include "Resampler.hpp"
+#include "ScanlineReader.hpp"
+#include "TiledImage.hpp"
+#include <QtConcurrent/QtConcurrentRun>
+#include <QtCore/QFutureWatcher>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QThreadPool>
+#include <QtGui/QImageIOHandler>
+#include <QtGui/QImageReader>
+#include <cmath>
+#include <utility>
+
+namespace
+{
+    // Minimum time between two preview updates while a file streams in
+    const int PreviewIntervalMs = 100;
+
+    // A scaled preview is only decoded when fitting the image takes this
+    // much reduction or more; closer than that, the rows arriving are
+    // preview enough
+    const int MinPreviewReduction = 2;
+
+    // What the display of a tiled image works from: the whole image reduced
+    // to about this many bytes, with no side past what QImage can hold
+    const qint64 OverviewBytes = 64ll * 1024 * 1024;
+    const int MaxOverviewSide = 16384;
+
+    // Rows decoded at once into a TiledImage; fewer, taller bands save the
+    // region decoders that have to start over from the top for every band
+    const qint64 TiledBandBytes = 256ll * 1024 * 1024;
+
+    struct TiledLoad
+    {
+        std::shared_ptr<TiledImage> image;
+        QImage overview;
+    };
+
+    int overviewFactor(const QSize &size)
+    {
+        const double bytes = double(size.width()) * size.height() * 4;
+        const int byArea = static_cast<int>(std::ceil(std::sqrt(bytes / OverviewBytes)));
+        const int bySide = (qMax(size.width(), size.height()) + MaxOverviewSide - 1) / MaxOverviewSide;
+        return qMax(1, qMax(byArea, bySide));
+    }
+
+    bool isWebP(const QString &filename)
+    {
+        return filename.endsWith(".webp", Qt::CaseInsensitive);
+    }
+
+    // Streams a WebP file, forwarding progress and newly decoded rows
+    QImage decodeWebPProgressively(const QString &filename, const std::atomic<bool> &cancelled, ImageLoadRelay *relay)
+    {
+        QElapsedTimer sincePreview;
+        sincePreview.start();
+        int publishedRows = 0;
+        int lastPercent = -1;
+
+        return WebPHandler::decodeIncremental(filename, [&](const QImage &image, int decodedRows, qint64 bytesRead, qint64 totalBytes)
+                                              {
+            if (cancelled.load())
+            {
+                return false;
+            }
+
+            int percent = totalBytes > 0 ? static_cast<int>(bytesRead * 100 / totalBytes) : 0;
+            if (percent != lastPercent)
+            {
+                lastPercent = percent;
+                emit relay->progressChanged(percent);
+            }
+
+            // The finished image replaces the preview anyway, so skip the last rows
+            if (decodedRows > publishedRows && decodedRows < image.height() && sincePreview.elapsed() >= PreviewIntervalMs)
+            {
+                QImage rows = image.copy(0, publishedRows, image.width(), decodedRows - publishedRows);
+                emit relay->rowsDecoded(rows, publishedRows, image.size());
+                publishedRows = decodedRows;
+                sincePreview.restart();
+            }
+            return true; });
+    }
+
+    // Fails every read once cancelled is set, so a QImageReader decoding
+    // from it gives up at its next read rather than running to the end.
+    // Reads also report how far into the file the decoder has got.
+    class CancellableFile : public QFile
+    {
+    public:
+        CancellableFile(const QString &filename, const std::atomic<bool> &cancelled, ImageLoadRelay *relay)
+            : QFile(filename), m_cancelled(cancelled), m_relay(relay), m_bytesRead(0), m_lastPercent(-1)
+        {
+        }
+
+    protected:
+        qint64 readData(char *data, qint64 maxSize) override
+        {
+            if (m_cancelled.load())
+            {
+                return -1;
+            }
+            const qint64 read = QFile::readData(data, maxSize);
+            if (read > 0 && size() > 0)
+            {
+                m_bytesRead += read;
+                const int percent = static_cast<int>(qMin<qint64>(100, m_bytesRead * 100 / size()));
+                if (percent != m_lastPercent)
+                {
+                    m_lastPercent = percent;
+                    emit m_relay->progressChanged(percent);
+                }
+            }
+            return read;
+        }
+
+    private:
+        const std::atomic<bool> &m_cancelled;
+        ImageLoadRelay *m_relay;
+        qint64 m_bytesRead;
+        int m_lastPercent;
+    };
+
+    // Decodes any format QImageReader knows, aborting once cancelled is set
+    QImage decodeCancellable(const QString &filename, const std::atomic<bool> &cancelled, ImageLoadRelay *relay)
+    {
+        CancellableFile file(filename, cancelled, relay);
+        if (!file.open(QIODevice::ReadOnly))
+        {
+            return QImage();
+        }
+        QImageReader reader(&file);
+        QImage image = reader.read();
+        return cancelled.load() ? QImage() : image;
+    }
+}
+
+ImageLoader::ImageLoader(QObject *parent)
+    : QObject(parent), m_loading(false)
+{
+}
+
+ImageLoader::~ImageLoader()
+{
+    // Workers only hold their own flag, so they can outlive the loader
+    if (m_cancelled)
+    {
+        m_cancelled->store(true);
+    }
+}
+
+void ImageLoader::load(const QString &filename, const QSize &fitSize)
+{
+    if (m_cancelled)
+    {
+        m_cancelled->store(true); // Drop the result of the previous load
+    }
+
+    auto cancelled = std::make_shared<std::atomic<bool>>(false);
+    m_cancelled = cancelled;
+
+    std::shared_ptr<ImageLoadRelay> relay(new ImageLoadRelay(), [](ImageLoadRelay *r)
+                                          { r->deleteLater(); });
+    connect(relay.get(), &ImageLoadRelay::progressChanged, this, [this, cancelled](int percent)
+            {
+        if (!cancelled->load())
+        {
+            emit progressChanged(percent);
+        } }, Qt::QueuedConnection);
+    connect(relay.get(), &ImageLoadRelay::rowsDecoded, this, [this, cancelled](const QImage &rows, int firstRow, const QSize &fullSize)
+            {
+        if (!cancelled->load())
+        {
+            emit rowsDecoded(rows, firstRow, fullSize);
+        } }, Qt::QueuedConnection);
+    connect(relay.get(), &ImageLoadRelay::previewDecoded, this, [this, cancelled](const QImage &preview, const QSize &fullSize)
+            {
+        if (!cancelled->load())
+        {
+            emit previewDecoded(preview, fullSize);
+        } }, Qt::QueuedConnection);
+
+    if (TiledImage::needsTiling(imageSize(filename)))
+    {
+        startTiledLoad(filename, cancelled, relay);
+        return;
+    }
+
+    auto *watcher = new QFutureWatcher<QImage>(this);
+    connect(watcher, &QFutureWatcher<QImage>::finished, this, [this, watcher, cancelled, filename]()
+            {
+        QImage image = watcher->result();
+        watcher->deleteLater();
+        if (cancelled->load())
+        {
+            return; // Superseded by another load
+        }
+
+        m_cancelled.reset();
+        m_loading = false;
+        emit loadingChanged(false);
+        if (image.isNull())
+        {
+            emit loadFailed(filename);
+        }
+        else
+        {
+            emit imageLoaded(image, filename);
+        }
+        // A preview still on its way is stale now
+        cancelled->store(true); });
+
+    watcher->setFuture(QtConcurrent::run([filename, cancelled, relay]()
+                                         {
+        if (cancelled->load())
+        {
+            return QImage(); // Superseded before it started
+        }
+        if (isWebP(filename))
+        {
+            return decodeWebPProgressively(filename, *cancelled, relay.get());
+        }
+        return decodeCancellable(filename, *cancelled, relay.get()); }));
+
+    if (fitSize.isValid())
+    {
+        // Only formats whose decoder scales while decoding, so the preview
+        // never exists at full size; it runs on its own worker next to the
+        // full decode
+        QThreadPool::globalInstance()->start([filename, fitSize, cancelled, relay]()
+                                             {
+            QSize fullSize = imageSize(filename);
+            if (cancelled->load() || !canDecodeScaled(filename) || (fullSize.width() < fitSize.width() * MinPreviewReduction &&
+                                      fullSize.height() < fitSize.height() * MinPreviewReduction))
+            {
+                return;
+            }
+            DecodeOptions options;
+            options.size = fullSize.scaled(fitSize, Qt::KeepAspectRatio).expandedTo(QSize(1, 1));
+            QImage preview = loadImage(filename, options);
+            if (!preview.isNull() && !cancelled->load())
+            {
+                emit relay->previewDecoded(preview, fullSize);
+            } });
+    }
+
+    if (!m_loading)
+    {
+        m_loading = true;
+        emit loadingChanged(true);
+    }
+}
+
+void ImageLoader::startTiledLoad(const QString &filename, const std::shared_ptr<std::atomic<bool>> &cancelled, const std::shared_ptr<ImageLoadRelay> &relay)
+{
+    auto *watcher = new QFutureWatcher<TiledLoad>(this);
+    connect(watcher, &QFutureWatcher<TiledLoad>::finished, this, [this, watcher, cancelled, filename]()
+            {
+        TiledLoad result = watcher->result();
+        watcher->deleteLater();
+        if (cancelled->load())
+        {
+            return; // Superseded by another load
+        }
+
+        m_cancelled.reset();
+        m_loading = false;
+        emit loadingChanged(false);
+        if (!result.image || result.overview.isNull())
+        {
+            emit loadFailed(filename);
+        }
+        else
+        {
+            emit tiledImageLoaded(result.image, result.overview, filename);
+        } });
+
+    // No preview: the overview is the first thing there is to show
+    watcher->setFuture(QtConcurrent::run([filename, cancelled, relay]()
+                                         {
+        TiledLoad result;
+        result.image = loadTiled(filename, [&](int percent)
+                                 {
+            emit relay->progressChanged(percent);
+            return !cancelled->load(); });
+        if (result.image && !cancelled->load())
+        {
+            result.overview = result.image->reduced(result.image->rect(), overviewFactor(result.image->size()));
+        }
+        return result; }));
+
+    if (!m_loading)
+    {
+        m_loading = true;
+        emit loadingChanged(true);
+    }
+}
+
+void ImageLoader::cancel()
+{
+    if (m_cancelled)
+    {
+        m_cancelled->store(true);
+        m_cancelled.reset();
+    }
+    if (m_loading)
+    {
+        m_loading = false;
+        emit loadingChanged(false);
+    }
+}
+
+QImage ImageLoader::loadImage(const QString &filename)
+{
+    QImage image;
+    if (isWebP(filename))
+    {
+        image = WebPHandler::decode(filename);
+    }
+    else
+    {
+        image.load(filename);
+    }
+    return image;
+}
+
+QImage ImageLoader::loadImage(const QString &filename, const DecodeOptions &options)
+{
+    if (options.isFull())
+    {
+        return loadImage(filename);
+    }
+    if (isWebP(filename))
+    {
+        return WebPHandler::decode(filename, options);
+    }
+
+    // Handlers that can clip or scale themselves are asked to (JPEG scales
+    // in the DCT domain). Whatever they cannot do is done after decoding,
+    // with a view for the crop and the resampler for the size, rather than
+    // by QImageReader's own fallback, which is a plain smooth scale.
+    QImageReader reader(filename);
+    const QRect full(QPoint(0, 0), reader.size());
+    const QRect region = options.region.isValid() ? options.region.intersected(full) : full;
+    const bool known = full.isValid();
+    if (known && region.isEmpty())
+    {
+        return QImage();
+    }
+    const bool scaled = options.size.isValid() && !options.size.isEmpty() && options.size != region.size();
+    const bool clipInDecoder = known && region != full && reader.supportsOption(QImageIOHandler::ClipRect);
+    const bool scaleInDecoder = known && scaled && (region == full || clipInDecoder) && reader.supportsOption(QImageIOHandler::ScaledSize);
+    if (clipInDecoder)
+    {
+        reader.setClipRect(region);
+    }
+    if (scaleInDecoder)
+    {
+        reader.setScaledSize(options.size);
+    }
+
+    QImage image = reader.read();
+    if (image.isNull())
+    {
+        return image;
+    }
+    if (!clipInDecoder && options.region.isValid())
+    {
+        QRect rect = options.region.intersected(image.rect());
+        if (rect.isEmpty())
+        {
+            return QImage();
+        }
+        image = EditPipeline::regionView(std::move(image), rect);
+    }
+    if (options.size.isValid() && !options.size.isEmpty() && options.size != image.size())
+    {
+        // Box is the area average a decoder's own downscaling comes closest to
+        ResampleOptions resample;
+        resample.filter = ResampleFilter::Box;
+        resample.threads = 1;
+        image = Resampler::resample(image, options.size, resample);
+    }
+    return image;
+}
+
+bool ImageLoader::canDecodeScaled(const QString &filename)
+{
+    return isWebP(filename) || QImageReader(filename).supportsOption(QImageIOHandler::ScaledSize);
+}
+
+bool ImageLoader::canDecodeRegion(const QString &filename)
+{
+    return isWebP(filename) || QImageReader(filename).supportsOption(QImageIOHandler::ClipRect);
+}
+
+std::unique_ptr<TiledImage> ImageLoader::loadTiled(const QString &filename, const std::function<bool(int percent)> &progress)
+{
+    // Files that can be read in order go into tiles a band at a time;
+    // other formats are decoded by region or, failing that, whole
+    std::unique_ptr<ScanlineReader> reader = ScanlineReader::open(filename);
+    const QSize size = reader ? reader->size() : imageSize(filename);
+    if (!size.isValid())
+    {
+        return nullptr;
+    }
+
+    // Without region decoding the whole image has to be decoded once; it
+    // is moved into tiles and released right after
+    QImage whole;
+    if (!reader && !canDecodeRegion(filename))
+    {
+        whole = loadImage(filename);
+        if (whole.size() != size)
+        {
+            return nullptr;
+        }
+    }
+
+    const int bandRows = static_cast<int>(qBound<qint64>(1, TiledBandBytes / (qint64(size.width()) * 4), size.height()));
+    std::unique_ptr<TiledImage> image;
+    for (int top = 0; top < size.height(); top += bandRows)
+    {
+        DecodeOptions options;
+        options.region = QRect(0, top, size.width(), qMin(bandRows, size.height() - top));
+        QImage band = reader ? reader->read(bandRows) : whole.isNull() ? loadImage(filename, options) : EditPipeline::regionView(whole, options.region);
+        if (band.size() != options.region.size())
+        {
+            return nullptr;
+        }
+        if (!image)
+        {
+            // Opaque images are stored without alpha, as QImage would
+            image = std::make_unique<TiledImage>(size, band.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32);
+            if (image->isNull())
+            {
+                return nullptr;
+            }
+        }
+        if (!image->write(band, options.region.topLeft()) ||
+            (progress && !progress(static_cast<int>(qint64(top + band.height()) * 100 / size.height()))))
+        {
+            return nullptr;
+        }
+    }
+    return image;
+}
+
+QSize ImageLoader::imageSize(const QString &filename)
+{
+    if (isWebP(filename))
+    {
+        return WebPHandler::imageSize(filename);
+    }
+    return QImageReader(filename).size();
+}
+
+QStringList ImageLoader::imageFiles(const QString &directory)
+{
+    static const QStringList nameFilters = {"*.png", "*.jpg", "*.jpeg", "*.bmp", "*.webp"};
+
+    QStringList files;
+    const QFileInfoList entries = QDir(directory).entryInfoList(nameFilters, QDir::Files, QDir::Name);
+    for (const QFileInfo &entry : entries)
+    {
+        files.append(entry.filePath());
+    }
+    return files;
+}
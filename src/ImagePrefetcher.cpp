@@ -0,0 +1,116 @@
+#include "ImagePrefetcher.hpp"
+#include "ImageLoader.hpp"
+#include "TiledImage.hpp"
+#include <QtCore/QFileInfo>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QThread>
+#include <memory>
+
+namespace
+{
+    // Enough to keep ahead of someone flipping through a folder without
+    // starving the decode of the file they actually opened
+    const int MaxThreads = 2;
+
+    int costOf(const QImage &image)
+    {
+        return static_cast<int>(qMax<qsizetype>(1, image.sizeInBytes() / 1024));
+    }
+}
+
+ImagePrefetcher::ImagePrefetcher(QObject *parent)
+    : QObject(parent)
+{
+    setMemoryBudget(DefaultMemoryBudget);
+    m_pool.setMaxThreadCount(qMin(MaxThreads, qMax(1, QThread::idealThreadCount() - 1)));
+    m_pool.setThreadPriority(QThread::LowPriority);
+}
+
+ImagePrefetcher::~ImagePrefetcher()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_queued.clear();
+    }
+    // Results still queued to this object are discarded with it
+    m_pool.clear();
+    m_pool.waitForDone();
+}
+
+void ImagePrefetcher::setMemoryBudget(qint64 bytes)
+{
+    m_cache.setMaxCost(static_cast<qsizetype>(qMax<qint64>(0, bytes) / 1024));
+}
+
+void ImagePrefetcher::prefetch(const QStringList &filenames)
+{
+    QMutexLocker locker(&m_mutex);
+    // Tasks of files that are not listed again find themselves unwanted
+    // when they come up and return at once
+    m_queued.clear();
+    int priority = static_cast<int>(filenames.size());
+    for (const QString &filename : filenames)
+    {
+        --priority;
+        if (m_cache.contains(filename) || m_decoding.contains(filename) || m_queued.contains(filename))
+        {
+            continue;
+        }
+        m_queued.insert(filename);
+        m_pool.start([this, filename]()
+                     { decode(filename); },
+                     priority);
+    }
+}
+
+QImage ImagePrefetcher::take(const QString &filename)
+{
+    // Taken out, so the caller holds the only reference and can edit the
+    // pixels in place
+    std::unique_ptr<Entry> entry(m_cache.take(filename));
+    if (!entry || entry->modified != QFileInfo(filename).lastModified())
+    {
+        return QImage();
+    }
+    return entry->image;
+}
+
+void ImagePrefetcher::insert(const QString &filename, const QImage &image)
+{
+    if (image.isNull())
+    {
+        return;
+    }
+    m_cache.insert(filename, new Entry{image, QFileInfo(filename).lastModified()}, costOf(image));
+}
+
+void ImagePrefetcher::decode(const QString &filename)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        if (!m_queued.remove(filename))
+        {
+            return; // No longer a neighbour, or a duplicate task
+        }
+        m_decoding.insert(filename);
+    }
+
+    // Read before decoding, so a file changed meanwhile counts as changed.
+    // Images that need tiling are imported when opened, not held here.
+    QDateTime modified = QFileInfo(filename).lastModified();
+    QImage image;
+    if (!TiledImage::needsTiling(ImageLoader::imageSize(filename)))
+    {
+        image = ImageLoader::loadImage(filename);
+    }
+    QMetaObject::invokeMethod(this, [this, filename, modified, image]()
+                              {
+        {
+            QMutexLocker locker(&m_mutex);
+            m_decoding.remove(filename);
+        }
+        if (!image.isNull())
+        {
+            m_cache.insert(filename, new Entry{image, modified}, costOf(image));
+        } }, Qt::QueuedConnection);
+}
@@ -0,0 +1,178 @@
+#include "ImagePyramid.hpp"
+#include "EditPipeline.hpp"
+#include <QtConcurrent/QtConcurrentRun>
+
+namespace
+{
+    // Rounded average of four premultiplied ARGB pixels, two channels per lane
+    inline quint32 average4(quint32 a, quint32 b, quint32 c, quint32 d)
+    {
+        quint32 rb = (a & 0x00ff00ff) + (b & 0x00ff00ff) + (c & 0x00ff00ff) + (d & 0x00ff00ff);
+        quint32 ag = ((a >> 8) & 0x00ff00ff) + ((b >> 8) & 0x00ff00ff) + ((c >> 8) & 0x00ff00ff) + ((d >> 8) & 0x00ff00ff);
+        rb = ((rb + 0x00020002) >> 2) & 0x00ff00ff;
+        ag = ((ag + 0x00020002) >> 2) & 0x00ff00ff;
+        return rb | (ag << 8);
+    }
+
+    // Formats whose 32-bit pixels can be averaged channel by channel as-is
+    inline bool isAveragingFormat(QImage::Format format)
+    {
+        return format == QImage::Format_ARGB32_Premultiplied || format == QImage::Format_RGB32;
+    }
+}
+
+ImagePyramid::ImagePyramid(QObject *parent)
+    : QObject(parent), m_fullRebuildPending(false), m_generation(0), m_buildGeneration(0)
+{
+    connect(&m_watcher, &QFutureWatcher<QVector<QImage>>::finished, this, &ImagePyramid::onBuildFinished);
+}
+
+ImagePyramid::~ImagePyramid()
+{
+    m_watcher.waitForFinished();
+}
+
+void ImagePyramid::setBaseImage(const QImage &image, const QRect &dirtyRect)
+{
+    bool sameSize = image.size() == m_base.size();
+    if (sameSize && image.cacheKey() == m_base.cacheKey())
+    {
+        return;
+    }
+
+    m_base = image;
+    ++m_generation;
+
+    if (!sameSize || !dirtyRect.isValid())
+    {
+        // Old levels no longer describe this image at all
+        m_levels.clear();
+        m_pendingDirtyRect = QRect();
+        m_fullRebuildPending = true;
+    }
+    else if (!m_fullRebuildPending)
+    {
+        m_pendingDirtyRect = m_pendingDirtyRect.isValid() ? m_pendingDirtyRect.united(dirtyRect) : dirtyRect;
+    }
+
+    startBuild();
+}
+
+QImage ImagePyramid::levelForScale(qreal scale, qreal *levelScale) const
+{
+    int index = 0;
+    qreal indexScale = 1.0;
+    while (index + 1 < m_levels.size() && indexScale * 0.5 >= scale)
+    {
+        ++index;
+        indexScale *= 0.5;
+    }
+
+    *levelScale = indexScale;
+    return index == 0 ? m_base : m_levels[index];
+}
+
+void ImagePyramid::startBuild()
+{
+    if (m_watcher.isRunning())
+    {
+        return; // onBuildFinished() picks up the pending work
+    }
+    if (m_base.isNull() || (m_base.width() <= MinLevelSize && m_base.height() <= MinLevelSize))
+    {
+        m_levels.clear();
+        m_pendingDirtyRect = QRect();
+        m_fullRebuildPending = false;
+        return;
+    }
+
+    QVector<QImage> previous = m_fullRebuildPending ? QVector<QImage>() : m_levels;
+    m_buildDirtyRect = m_fullRebuildPending ? QRect() : m_pendingDirtyRect;
+    m_buildGeneration = m_generation;
+    m_pendingDirtyRect = QRect();
+    m_fullRebuildPending = false;
+
+    m_watcher.setFuture(QtConcurrent::run(&ImagePyramid::buildLevels, m_base, previous, m_buildDirtyRect));
+}
+
+void ImagePyramid::onBuildFinished()
+{
+    QVector<QImage> levels = m_watcher.result();
+
+    // A full rebuild requested meanwhile means these levels are for an image
+    // that is gone; a partial edit only needs its region refreshed again
+    if (!m_fullRebuildPending && !levels.isEmpty() && levels.first().size() == m_base.size())
+    {
+        m_levels = levels;
+        emit levelsUpdated(m_buildDirtyRect);
+    }
+
+    if (m_buildGeneration != m_generation)
+    {
+        startBuild();
+    }
+}
+
+QVector<QImage> ImagePyramid::buildLevels(const QImage &base, QVector<QImage> levels, const QRect &dirtyRect)
+{
+    bool incremental = dirtyRect.isValid() && !levels.isEmpty() && levels.first().size() == base.size();
+    QRect dirty = incremental ? dirtyRect.intersected(base.rect()) : base.rect();
+
+    QVector<QImage> result;
+    result.append(base);
+
+    QImage previous = base;
+    int level = 1;
+    while (previous.width() > MinLevelSize || previous.height() > MinLevelSize)
+    {
+        QSize nextSize((previous.width() + 1) / 2, (previous.height() + 1) / 2);
+
+        // The region of this level that depends on the dirty source pixels
+        QRect targetRect(QPoint(dirty.left() / 2, dirty.top() / 2), QPoint(dirty.right() / 2, dirty.bottom() / 2));
+        QRect sourceRect = QRect(targetRect.x() * 2, targetRect.y() * 2, targetRect.width() * 2, targetRect.height() * 2)
+                               .intersected(previous.rect());
+
+        // Only the base can come in an arbitrary format; convert just what is read
+        QImage source = previous;
+        QPoint sourceOrigin(0, 0);
+        if (!isAveragingFormat(previous.format()))
+        {
+            source = EditPipeline::regionView(previous, sourceRect).convertToFormat(QImage::Format_ARGB32_Premultiplied);
+            sourceOrigin = sourceRect.topLeft();
+        }
+
+        QImage target = (incremental && level < levels.size()) ? levels[level] : QImage(nextSize, QImage::Format_ARGB32_Premultiplied);
+        if (target.isNull() || source.isNull())
+        {
+            break; // Out of memory; keep the levels built so far
+        }
+        halveRegion(source, sourceOrigin, target, targetRect);
+
+        result.append(target);
+        previous = target;
+        dirty = targetRect;
+        ++level;
+    }
+    return result;
+}
+
+void ImagePyramid::halveRegion(const QImage &source, const QPoint &sourceOrigin, QImage &target, const QRect &targetRect)
+{
+    // Edge pixels of odd-sized sources are repeated
+    int maxX = source.width() - 1;
+    int maxY = source.height() - 1;
+    for (int y = targetRect.top(); y <= targetRect.bottom(); ++y)
+    {
+        int sy0 = qMin(2 * y - sourceOrigin.y(), maxY);
+        int sy1 = qMin(sy0 + 1, maxY);
+        const quint32 *row0 = reinterpret_cast<const quint32 *>(source.constScanLine(sy0));
+        const quint32 *row1 = reinterpret_cast<const quint32 *>(source.constScanLine(sy1));
+        quint32 *out = reinterpret_cast<quint32 *>(target.scanLine(y));
+        for (int x = targetRect.left(); x <= targetRect.right(); ++x)
+        {
+            int sx0 = qMin(2 * x - sourceOrigin.x(), maxX);
+            int sx1 = qMin(sx0 + 1, maxX);
+            out[x] = average4(row0[sx0], row0[sx1], row1[sx0], row1[sx1]);
+        }
+    }
+}
@@ -0,0 +1,185 @@
+#include "ImageSaver.hpp"
+#include "TiledImage.hpp"
+#include <QtConcurrent/QtConcurrentRun>
+#include <QtCore/QFutureWatcher>
+
+namespace
+{
+    struct SaveResult
+    {
+        bool success = false;
+        WebPEncodeStats stats;
+    };
+
+    bool encode(const QImage &image, const QString &filename, const WebPEncodeOptions &options, WebPEncodeStats *stats)
+    {
+        if (filename.endsWith(".webp", Qt::CaseInsensitive))
+        {
+            return WebPHandler::encode(image, filename, options, stats);
+        }
+        return image.save(filename);
+    }
+
+    // Output of edits on a tiled source, if it fits into one QImage. A
+    // resize first averages whole blocks while reading the tiles, so the
+    // resampler only sees at most twice the pixels it writes.
+    QImage applyTiled(const TiledImage &source, const EditPipeline &edits, int threads = 0)
+    {
+        const QRect crop = edits.sourceRect();
+        const Orientation orientation = edits.orientation();
+        if (!edits.isScaled())
+        {
+            if (TiledImage::needsTiling(crop.size()))
+            {
+                return QImage();
+            }
+            return orientation.apply(source.read(crop), threads);
+        }
+
+        const QSize scaledSource = orientation.inverted().mapSize(edits.outputSize());
+        const int factor = qMin(Resampler::reductionFactor(crop.width(), scaledSource.width()),
+                                Resampler::reductionFactor(crop.height(), scaledSource.height()));
+        const QSize reducedSize((crop.width() + factor - 1) / factor, (crop.height() + factor - 1) / factor);
+        if (TiledImage::needsTiling(reducedSize))
+        {
+            return QImage();
+        }
+        QImage reduced = source.reduced(crop, factor, threads);
+        if (reduced.isNull())
+        {
+            return QImage();
+        }
+        EditPipeline rest(reduced.size());
+        rest.orient(orientation);
+        rest.resize(edits.outputSize(), edits.filter());
+        return rest.apply(std::move(reduced), threads);
+    }
+}
+
+ImageSaver::ImageSaver(QObject *parent)
+    : QObject(parent), m_saving(false)
+{
+}
+
+ImageSaver::~ImageSaver()
+{
+    // An encode still running aborts at its next progress report
+    if (m_cancelled)
+    {
+        m_cancelled->store(true);
+    }
+}
+
+bool ImageSaver::save(const QImage &source, const EditPipeline &edits, const QString &filename, const WebPEncodeOptions &options)
+{
+    if (source.isNull())
+    {
+        return false;
+    }
+    return start(filename, options, [source, edits, filename](const WebPEncodeOptions &workerOptions, const std::atomic<bool> &cancelled, WebPEncodeStats *stats)
+                 {
+        QImage image = edits.apply(source);
+        if (image.isNull() || cancelled.load())
+        {
+            return false;
+        }
+        return encode(image, filename, workerOptions, stats); });
+}
+
+bool ImageSaver::save(const std::shared_ptr<TiledImage> &source, const EditPipeline &edits, const QString &filename, const WebPEncodeOptions &options)
+{
+    if (!source || source->isNull())
+    {
+        return false;
+    }
+    return start(filename, options, [source, edits, filename](const WebPEncodeOptions &workerOptions, const std::atomic<bool> &cancelled, WebPEncodeStats *stats)
+                 {
+        // Streamed to disk without ever being in memory at once
+        if (!edits.isScaled() && TiledImage::needsTiling(edits.outputSize()))
+        {
+            if (!filename.endsWith(".bmp", Qt::CaseInsensitive))
+            {
+                return false;
+            }
+            if (edits.isIdentity())
+            {
+                return source->saveBmp(filename);
+            }
+            std::unique_ptr<TiledImage> edited = source->transformed(edits.sourceRect(), edits.orientation());
+            return edited && !cancelled.load() && edited->saveBmp(filename);
+        }
+
+        QImage image = applyTiled(*source, edits);
+        if (image.isNull() || cancelled.load())
+        {
+            return false;
+        }
+        return encode(image, filename, workerOptions, stats); });
+}
+
+bool ImageSaver::start(const QString &filename, const WebPEncodeOptions &options, WriteFunction write)
+{
+    if (m_saving)
+    {
+        return false;
+    }
+
+    auto cancelled = std::make_shared<std::atomic<bool>>(false);
+    m_cancelled = cancelled;
+
+    std::shared_ptr<ImageSaveRelay> relay(new ImageSaveRelay(), [](ImageSaveRelay *r)
+                                          { r->deleteLater(); });
+    connect(relay.get(), &ImageSaveRelay::progressChanged, this, [this, cancelled](int percent)
+            {
+        if (!cancelled->load())
+        {
+            emit progressChanged(percent);
+        } }, Qt::QueuedConnection);
+
+    auto *watcher = new QFutureWatcher<SaveResult>(this);
+    connect(watcher, &QFutureWatcher<SaveResult>::finished, this, [this, watcher, cancelled, filename]()
+            {
+        SaveResult result = watcher->result();
+        watcher->deleteLater();
+
+        m_cancelled.reset();
+        m_saving = false;
+        emit savingChanged(false);
+        if (result.success)
+        {
+            emit imageSaved(filename, result.stats); // Finished before the abort got through
+        }
+        else if (cancelled->load())
+        {
+            emit saveCancelled(filename);
+        }
+        else
+        {
+            emit saveFailed(filename);
+        } });
+
+    WebPEncodeOptions workerOptions = options;
+    workerOptions.progress = [cancelled, relay](int percent)
+    {
+        emit relay->progressChanged(percent);
+        return !cancelled->load();
+    };
+
+    watcher->setFuture(QtConcurrent::run([write, workerOptions, cancelled]()
+                                         {
+        SaveResult result;
+        result.success = write(workerOptions, *cancelled, &result.stats);
+        return result; }));
+
+    m_saving = true;
+    emit savingChanged(true);
+    return true;
+}
+
+void ImageSaver::cancel()
+{
+    if (m_cancelled)
+    {
+        m_cancelled->store(true); // finished() still reports the outcome
+    }
+}
@@ -1,14 +1,62 @@
 #include "OpenSaveTool.hpp"
 #include "ImageEditor.hpp"
 #include "WebPHandler.hpp" // For WebP encoding/decoding
+#include "ImageLoader.hpp"
+#include "ImageSaver.hpp"
+#include "ImagePrefetcher.hpp"
+#include "EditHistory.hpp"
+#include "TiledImage.hpp"
 #include <QtWidgets/QFileDialog>
 #include <QtWidgets/QMessageBox>
+#include <QtWidgets/QLabel>
+#include <QtWidgets/QStatusBar>
 #include <QtCore/QStandardPaths>
 #include <QtCore/QFileInfo>
+#include <QtGui/QKeySequence>
+
+namespace
+{
+    // Images decoded ahead on either side of the open one
+    const int PrefetchRadius = 2;
+}
 
 OpenSaveTool::OpenSaveTool(QObject *parent)
-    : QObject(parent), m_editor(nullptr), m_openSaveGroup(nullptr), m_openBtn(nullptr), m_saveBtn(nullptr), m_infoBtn(nullptr)
+    : QObject(parent), m_editor(nullptr), m_openSaveGroup(nullptr), m_openBtn(nullptr), m_previousBtn(nullptr), m_nextBtn(nullptr), m_saveBtn(nullptr), m_infoBtn(nullptr), m_loadProgress(nullptr), m_profileCombo(nullptr), m_qualitySpinBox(nullptr), m_saveProgress(nullptr), m_cancelSaveBtn(nullptr), m_loader(new ImageLoader(this)), m_prefetcher(new ImagePrefetcher(this)), m_saver(new ImageSaver(this))
 {
+    // Decoding happens on a worker thread; results come back queued to the GUI thread
+    connect(m_loader, &ImageLoader::imageLoaded, this, &OpenSaveTool::onImageLoaded, Qt::QueuedConnection);
+    connect(m_loader, &ImageLoader::loadFailed, this, &OpenSaveTool::onLoadFailed, Qt::QueuedConnection);
+    connect(m_loader, &ImageLoader::tiledImageLoaded, this, [this](const std::shared_ptr<TiledImage> &image, const QImage &overview, const QString &fileName)
+            {
+        if (!m_editor)
+            return;
+
+        m_editor->setTiledDocument(image, overview);
+        m_editor->setCurrentFilePath(fileName);
+        m_editor->updateDisplay();
+        updateNeighbours(); }, Qt::QueuedConnection);
+    connect(m_loader, &ImageLoader::rowsDecoded, this, [this](const QImage &rows, int firstRow, const QSize &fullSize)
+            {
+        if (m_editor)
+        {
+            m_editor->showPreviewRows(rows, firstRow, fullSize);
+        } }, Qt::QueuedConnection);
+    connect(m_loader, &ImageLoader::previewDecoded, this, [this](const QImage &preview, const QSize &fullSize)
+            {
+        if (m_editor)
+        {
+            m_editor->showScaledPreview(preview, fullSize);
+        } }, Qt::QueuedConnection);
+
+    // Encoding runs on a worker thread too; outcomes arrive on the GUI thread
+    connect(m_saver, &ImageSaver::imageSaved, this, &OpenSaveTool::onImageSaved);
+    connect(m_saver, &ImageSaver::saveFailed, this, &OpenSaveTool::onSaveFailed);
+    connect(m_saver, &ImageSaver::saveCancelled, this, [this](const QString &fileName)
+            {
+        if (m_editor)
+        {
+            m_editor->statusBar()->showMessage(tr("Saving %1 cancelled").arg(QFileInfo(fileName).fileName()));
+        } });
 }
 
 QWidget *OpenSaveTool::getToolWidget()
@@ -22,13 +70,89 @@ QWidget *OpenSaveTool::getToolWidget()
         connect(m_openBtn, &QPushButton::clicked, this, &OpenSaveTool::openImage);
         layout->addWidget(m_openBtn);
 
+        // Previous/next image in the open file's folder
+        QHBoxLayout *navigationLayout = new QHBoxLayout();
+        m_previousBtn = new QPushButton(tr("Previous"));
+        m_previousBtn->setShortcut(QKeySequence(Qt::Key_PageUp));
+        m_previousBtn->setEnabled(false);
+        connect(m_previousBtn, &QPushButton::clicked, this, &OpenSaveTool::openPrevious);
+        m_nextBtn = new QPushButton(tr("Next"));
+        m_nextBtn->setShortcut(QKeySequence(Qt::Key_PageDown));
+        m_nextBtn->setEnabled(false);
+        connect(m_nextBtn, &QPushButton::clicked, this, &OpenSaveTool::openNext);
+        navigationLayout->addWidget(m_previousBtn);
+        navigationLayout->addWidget(m_nextBtn);
+        layout->addLayout(navigationLayout);
+
         m_saveBtn = new QPushButton(tr("Save Image"));
         connect(m_saveBtn, &QPushButton::clicked, this, &OpenSaveTool::saveImage);
         layout->addWidget(m_saveBtn);
 
+        // WebP encoder settings
+        QHBoxLayout *profileLayout = new QHBoxLayout();
+        QLabel *profileLabel = new QLabel(tr("WebP:"));
+        m_profileCombo = new QComboBox();
+        m_profileCombo->addItem(tr("Fast"), static_cast<int>(WebPEncodeProfile::Fast));
+        m_profileCombo->addItem(tr("Balanced"), static_cast<int>(WebPEncodeProfile::Balanced));
+        m_profileCombo->addItem(tr("Max compression"), static_cast<int>(WebPEncodeProfile::MaxCompression));
+        m_profileCombo->addItem(tr("Lossless"), static_cast<int>(WebPEncodeProfile::Lossless));
+        m_profileCombo->setCurrentIndex(1);
+        profileLayout->addWidget(profileLabel);
+        profileLayout->addWidget(m_profileCombo);
+        layout->addLayout(profileLayout);
+
+        QHBoxLayout *qualityLayout = new QHBoxLayout();
+        QLabel *qualityLabel = new QLabel(tr("Quality:"));
+        m_qualitySpinBox = new QSpinBox();
+        m_qualitySpinBox->setRange(0, 100);
+        m_qualitySpinBox->setValue(90);
+        qualityLayout->addWidget(qualityLabel);
+        qualityLayout->addWidget(m_qualitySpinBox);
+        layout->addLayout(qualityLayout);
+
+        // Quality has no meaning for lossless output
+        connect(m_profileCombo, QOverload<int>::of(&QComboBox::currentIndexChanged), this, [this](int)
+                { m_qualitySpinBox->setEnabled(encodeOptions().profile != WebPEncodeProfile::Lossless); });
+
         m_infoBtn = new QPushButton(tr("Image Info"));
         connect(m_infoBtn, &QPushButton::clicked, this, &OpenSaveTool::showImageInfo);
         layout->addWidget(m_infoBtn);
+
+        // Busy indicator while a file is being decoded; turns into a
+        // percentage for formats that report progress
+        m_loadProgress = new QProgressBar();
+        m_loadProgress->setRange(0, 0);
+        m_loadProgress->setTextVisible(false);
+        m_loadProgress->setVisible(false);
+        connect(m_loader, &ImageLoader::loadingChanged, m_loadProgress, [this](bool loading)
+                {
+            m_loadProgress->setRange(0, 0);
+            m_loadProgress->setVisible(loading); });
+        connect(m_loader, &ImageLoader::progressChanged, m_loadProgress, [this](int percent)
+                {
+            m_loadProgress->setRange(0, 100);
+            m_loadProgress->setValue(percent); });
+        layout->addWidget(m_loadProgress);
+
+        // Save progress, driven by the WebP encoder; busy for other formats
+        m_saveProgress = new QProgressBar();
+        m_saveProgress->setRange(0, 0);
+        m_saveProgress->setVisible(false);
+        m_cancelSaveBtn = new QPushButton(tr("Cancel Save"));
+        m_cancelSaveBtn->setVisible(false);
+        connect(m_cancelSaveBtn, &QPushButton::clicked, m_saver, &ImageSaver::cancel);
+        connect(m_saver, &ImageSaver::savingChanged, m_saveProgress, [this](bool saving)
+                {
+            m_saveProgress->setRange(0, 0);
+            m_saveProgress->setVisible(saving);
+            m_cancelSaveBtn->setVisible(saving);
+            m_saveBtn->setEnabled(!saving); });
+        connect(m_saver, &ImageSaver::progressChanged, m_saveProgress, [this](int percent)
+                {
+            m_saveProgress->setRange(0, 100);
+            m_saveProgress->setValue(percent); });
+        layout->addWidget(m_saveProgress);
+        layout->addWidget(m_cancelSaveBtn);
     }
     return m_openSaveGroup;
 }
@@ -63,36 +187,137 @@ void OpenSaveTool::openImage()
     {
         return;
     }
+    openFile(fileName);
+}
 
-    QImage loadedImage;
-    if (fileName.endsWith(".webp", Qt::CaseInsensitive))
+bool OpenSaveTool::openFile(const QString &fileName)
+{
+    if (!m_editor || !confirmDiscardEdits())
+        return false;
+
+    loadFile(fileName);
+    return true;
+}
+
+bool OpenSaveTool::confirmDiscardEdits()
+{
+    if (!m_editor->hasImage() || !m_editor->getHistory()->canUndo())
+    {
+        return true;
+    }
+    return QMessageBox::question(m_openSaveGroup, tr("Discard Edits"),
+                                 tr("Opening another image discards the edits to this one, and their undo history. Continue?"),
+                                 QMessageBox::Discard | QMessageBox::Cancel, QMessageBox::Cancel) == QMessageBox::Discard;
+}
+
+void OpenSaveTool::loadFile(const QString &fileName)
+{
+    // Opening another file while one is still loading cancels the first.
+    // Large files show a fit-to-window decode while the full one runs.
+    m_loader->load(fileName, m_editor->getGraphicsView()->viewport()->size());
+}
+
+void OpenSaveTool::onImageLoaded(const QImage &image, const QString &fileName)
+{
+    if (!m_editor)
+        return;
+
+    m_editor->setDocumentImage(image);
+    m_editor->setCurrentFilePath(fileName);
+    m_editor->updateDisplay();
+    updateNeighbours();
+}
+
+void OpenSaveTool::openPrevious()
+{
+    openNeighbour(-1);
+}
+
+void OpenSaveTool::openNext()
+{
+    openNeighbour(1);
+}
+
+void OpenSaveTool::openNeighbour(int offset)
+{
+    if (!m_editor || m_editor->getCurrentFilePath().isEmpty())
     {
-        loadedImage = WebPHandler::decode(fileName);
+        return;
     }
-    else
+    const QFileInfo current(m_editor->getCurrentFilePath());
+    const QStringList files = ImageLoader::imageFiles(current.absolutePath());
+    const int currentIndex = files.indexOf(current.absoluteFilePath());
+    const int index = currentIndex + offset;
+    if (currentIndex < 0 || index < 0 || index >= files.size())
     {
-        loadedImage.load(fileName);
+        return; // Not in the listing any more, or already at the end
+    }
+    if (!confirmDiscardEdits())
+    {
+        return;
+    }
+
+    // An unedited image is kept too, so stepping back is just as quick;
+    // not the overview of a tiled one, which is imported again instead
+    if (m_editor->hasImage() && !m_editor->getHistory()->canUndo() && !m_editor->getTiledSource())
+    {
+        m_prefetcher->insert(current.absoluteFilePath(), m_editor->getSourceImage());
     }
 
-    if (loadedImage.isNull())
+    QImage image = m_prefetcher->take(files[index]);
+    if (image.isNull())
     {
-        QMessageBox::warning(m_openSaveGroup, tr("Error"), tr("Could not load image."));
+        loadFile(files[index]);
         return;
     }
+    m_loader->cancel(); // A load still running is older than this
+    onImageLoaded(image, files[index]);
+}
 
-    m_editor->setCurrentImage(loadedImage);
-    m_editor->setCurrentFilePath(fileName); // Assuming ImageEditor has setCurrentFilePath
-    // m_editor->setLastDirectory(QFileInfo(fileName).path()); // Assuming ImageEditor has setLastDirectory
-    // Update spin boxes in ImageEditor if they exist and are accessible
-    // This part needs careful consideration. If spin boxes are part of ResizeTool,
-    // OpenSaveTool shouldn't directly access them. ImageEditor should coordinate.
-    // For now, I'll assume ImageEditor will handle updating its UI elements after image load.
-    m_editor->updateDisplay();
+void OpenSaveTool::updateNeighbours()
+{
+    const QFileInfo current(m_editor->getCurrentFilePath());
+    const QStringList files = ImageLoader::imageFiles(current.absolutePath());
+    const int index = files.indexOf(current.absoluteFilePath());
+    if (m_previousBtn)
+    {
+        m_previousBtn->setEnabled(index > 0);
+        m_nextBtn->setEnabled(index >= 0 && index + 1 < files.size());
+    }
+    if (index < 0)
+    {
+        return;
+    }
+
+    // Nearest first, and forward before backward at the same distance
+    QStringList neighbours;
+    for (int distance = 1; distance <= PrefetchRadius; ++distance)
+    {
+        if (index + distance < files.size())
+        {
+            neighbours.append(files[index + distance]);
+        }
+        if (index - distance >= 0)
+        {
+            neighbours.append(files[index - distance]);
+        }
+    }
+    m_prefetcher->prefetch(neighbours);
+}
+
+void OpenSaveTool::onLoadFailed(const QString &fileName)
+{
+    Q_UNUSED(fileName);
+    if (m_editor)
+    {
+        m_editor->updateDisplay(); // Replace any partial preview
+    }
+    QMessageBox::warning(m_openSaveGroup, tr("Error"), tr("Could not load image."));
 }
 
 void OpenSaveTool::saveImage()
 {
-    if (!m_editor || m_editor->getCurrentImage().isNull())
+    if (!m_editor || !m_editor->hasImage())
     {
         return;
     }
@@ -115,37 +340,80 @@ void OpenSaveTool::saveImage()
         return;
     }
 
-    bool success;
-    if (fileName.endsWith(".webp", Qt::CaseInsensitive))
+    // The worker replays the edits on the full-resolution source and
+    // encodes the result, so editing can go on while it runs
+    const std::shared_ptr<TiledImage> tiledSource = m_editor->getTiledSource();
+    const EditPipeline edits = m_editor->getPendingEdits();
+    if (tiledSource && TiledImage::needsTiling(edits.outputSize()) && (edits.isScaled() || !fileName.endsWith(".bmp", Qt::CaseInsensitive)))
     {
-        success = WebPHandler::encode(m_editor->getCurrentImage(), fileName, 90);
+        QMessageBox::warning(m_openSaveGroup, tr("Error"), tr("Images this large can only be saved as BMP, and without resizing."));
+        return;
     }
-    else
+    bool started = tiledSource ? m_saver->save(tiledSource, edits, fileName, encodeOptions())
+                               : m_saver->save(m_editor->getSourceImage(), edits, fileName, encodeOptions());
+    if (!started)
     {
-        success = m_editor->getCurrentImage().save(fileName);
+        QMessageBox::warning(m_openSaveGroup, tr("Error"), tr("Another save is still in progress."));
+        return;
     }
+    // Only the WebP encoder can be interrupted
+    m_cancelSaveBtn->setEnabled(fileName.endsWith(".webp", Qt::CaseInsensitive));
+}
+
+void OpenSaveTool::onImageSaved(const QString &fileName, const WebPEncodeStats &stats)
+{
+    if (!m_editor)
+        return;
 
-    if (!success)
+    m_editor->setCurrentFilePath(fileName); // Update current file path after saving
+    if (fileName.endsWith(".webp", Qt::CaseInsensitive))
     {
-        QMessageBox::warning(m_openSaveGroup, tr("Error"), tr("Could not save image."));
+        m_editor->statusBar()->showMessage(tr("Saved %1 (%2 KiB) in %3 ms with the %4 profile")
+                                               .arg(QFileInfo(fileName).fileName())
+                                               .arg(stats.outputBytes / 1024)
+                                               .arg(stats.encodeMs)
+                                               .arg(m_profileCombo->itemText(m_profileCombo->findData(static_cast<int>(stats.profile)))));
     }
-    else
+}
+
+void OpenSaveTool::onSaveFailed(const QString &fileName)
+{
+    Q_UNUSED(fileName);
+    QMessageBox::warning(m_openSaveGroup, tr("Error"), tr("Could not save image."));
+}
+
+WebPEncodeOptions OpenSaveTool::encodeOptions() const
+{
+    WebPEncodeOptions options;
+    if (m_profileCombo && m_qualitySpinBox)
     {
-        m_editor->setCurrentFilePath(fileName); // Update current file path after saving
+        options.profile = static_cast<WebPEncodeProfile>(m_profileCombo->currentData().toInt());
+        options.quality = m_qualitySpinBox->value();
     }
+    return options;
 }
 
 void OpenSaveTool::showImageInfo()
 {
-    if (!m_editor || m_editor->getCurrentImage().isNull())
+    if (!m_editor || !m_editor->hasImage())
     {
         return;
     }
 
-    QImage currentImage = m_editor->getCurrentImage();
-    QString info = tr("Dimensions: %1 x %2\n").arg(currentImage.width()).arg(currentImage.height());
-    info += tr("Format: %1\n").arg(currentImage.format());
-    info += tr("Depth: %1 bits\n").arg(currentImage.depth());
+    // Pending edits change the size only; no need to replay them here
+    QSize currentSize = m_editor->getCurrentSize();
+    const QImage &sourceImage = m_editor->getSourceImage();
+    QString info = tr("Dimensions: %1 x %2\n").arg(currentSize.width()).arg(currentSize.height());
+    info += tr("Format: %1\n").arg(sourceImage.format());
+    info += tr("Depth: %1 bits\n").arg(sourceImage.depth());
+    if (const std::shared_ptr<TiledImage> tiledSource = m_editor->getTiledSource())
+    {
+        info += tr("Stored in tiles: %1 x %2 source, shown from a %3 x %4 overview\n")
+                    .arg(tiledSource->size().width())
+                    .arg(tiledSource->size().height())
+                    .arg(sourceImage.width())
+                    .arg(sourceImage.height());
+    }
 
     QMessageBox::information(m_openSaveGroup, tr("Image Information"), info);
 }
@@ -0,0 +1,447 @@
+#include "Resampler.hpp"
+#include "ResamplerKernels.hpp"
+#include "RowBands.hpp"
+#include <QtCore/QSizeF>
+#include <QtGui/QColorSpace>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(EZ_RESAMPLER_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    // Bands smaller than this cost more to schedule than to filter
+    constexpr int MinBandRows = 16;
+    // Box reduction stops while the filter still has at least this much
+    // reduction left, so it keeps smoothing the result
+    constexpr double ReducingGap = 2.0;
+    constexpr double Pi = 3.14159265358979323846;
+
+    double filterSupport(ResampleFilter filter)
+    {
+        switch (filter)
+        {
+        case ResampleFilter::Box:
+            return 0.5;
+        case ResampleFilter::Bilinear:
+            return 1.0;
+        case ResampleFilter::Bicubic:
+            return 2.0;
+        case ResampleFilter::Lanczos3:
+            break;
+        }
+        return 3.0;
+    }
+
+    double sinc(double x)
+    {
+        if (x == 0.0)
+        {
+            return 1.0;
+        }
+        x *= Pi;
+        return std::sin(x) / x;
+    }
+
+    double filterWeight(ResampleFilter filter, double x)
+    {
+        x = std::abs(x);
+        switch (filter)
+        {
+        case ResampleFilter::Box:
+            return x < 0.5 ? 1.0 : 0.0;
+        case ResampleFilter::Bilinear:
+            return x < 1.0 ? 1.0 - x : 0.0;
+        case ResampleFilter::Bicubic:
+        {
+            // Keys cubic with a = -0.5 (Catmull-Rom)
+            const double a = -0.5;
+            if (x < 1.0)
+                return ((a + 2.0) * x - (a + 3.0)) * x * x + 1.0;
+            if (x < 2.0)
+                return (((x - 5.0) * x + 8.0) * x - 4.0) * a;
+            return 0.0;
+        }
+        case ResampleFilter::Lanczos3:
+            break;
+        }
+        return x < 3.0 ? sinc(x) * sinc(x / 3.0) : 0.0;
+    }
+
+    // Weights along one axis: output sample i is the sum over k < taps of
+    // weights[i * taps + k] * input[starts[i] + k]. Every sample has the
+    // same number of taps (zero-padded), which keeps the kernels branch-free.
+    struct AxisCoefficients
+    {
+        int taps = 0;
+        std::vector<int> starts;
+        std::vector<std::int16_t> weights;
+    };
+
+    // extent is the length of the input in its own samples; it is below
+    // inSize when the last sample is a partial box-reduced block
+    AxisCoefficients computeCoefficients(int inSize, double extent, int outSize, ResampleFilter filter)
+    {
+        // Downscaling stretches the filter over the input so that every
+        // input sample contributes
+        const double scale = extent / outSize;
+        const double filterScale = std::max(scale, 1.0);
+        const double support = filterSupport(filter) * filterScale;
+
+        std::vector<int> first(outSize);
+        std::vector<int> count(outSize);
+        int taps = 1;
+        for (int i = 0; i < outSize; ++i)
+        {
+            double center = (i + 0.5) * scale;
+            int low = std::max(0, static_cast<int>(std::floor(center - support + 0.5)));
+            int high = std::min(inSize, static_cast<int>(std::floor(center + support + 0.5)));
+            if (high <= low)
+            {
+                low = std::min(static_cast<int>(center), inSize - 1);
+                high = low + 1;
+            }
+            first[i] = low;
+            count[i] = high - low;
+            taps = std::max(taps, count[i]);
+        }
+
+        AxisCoefficients coefficients;
+        coefficients.taps = taps;
+        coefficients.starts.resize(outSize);
+        coefficients.weights.assign(static_cast<size_t>(outSize) * taps, 0);
+
+        const int one = 1 << ResamplerKernels::WeightBits;
+        std::vector<double> weights(taps);
+        for (int i = 0; i < outSize; ++i)
+        {
+            double center = (i + 0.5) * scale;
+            double sum = 0.0;
+            for (int k = 0; k < count[i]; ++k)
+            {
+                weights[k] = filterWeight(filter, (first[i] + k + 0.5 - center) / filterScale);
+                sum += weights[k];
+            }
+
+            // Windows near the end are moved back so all taps stay inside
+            int start = std::min(first[i], inSize - taps);
+            std::int16_t *out = coefficients.weights.data() + static_cast<size_t>(i) * taps + (first[i] - start);
+            coefficients.starts[i] = start;
+
+            if (sum == 0.0)
+            {
+                out[count[i] / 2] = static_cast<std::int16_t>(one); // Nearest sample
+                continue;
+            }
+
+            // Rounding error goes to the largest weight, so that flat areas
+            // stay exactly flat
+            int total = 0;
+            int largest = 0;
+            for (int k = 0; k < count[i]; ++k)
+            {
+                out[k] = static_cast<std::int16_t>(std::lround(weights[k] / sum * one));
+                total += out[k];
+                if (std::abs(out[k]) > std::abs(out[largest]))
+                {
+                    largest = k;
+                }
+            }
+            out[largest] = static_cast<std::int16_t>(out[largest] + one - total);
+        }
+        return coefficients;
+    }
+
+    struct Kernels
+    {
+        ResamplerKernels::HorizontalFn horizontal;
+        ResamplerKernels::VerticalFn vertical;
+        ResamplerKernels::ReduceFn reduce;
+    };
+
+    Kernels kernelsFor(SimdLevel level)
+    {
+#if defined(EZ_RESAMPLER_X86)
+        if (level == SimdLevel::AVX2)
+        {
+            return {ResamplerKernels::horizontalAVX2, ResamplerKernels::verticalAVX2, ResamplerKernels::reduceAVX2};
+        }
+        if (level == SimdLevel::SSE41)
+        {
+            return {ResamplerKernels::horizontalSSE41, ResamplerKernels::verticalSSE41, ResamplerKernels::reduceSSE41};
+        }
+#endif
+        Q_UNUSED(level);
+        return {ResamplerKernels::horizontalScalar, ResamplerKernels::verticalScalar, ResamplerKernels::reduceScalar};
+    }
+
+#if defined(EZ_RESAMPLER_X86)
+    SimdLevel detectSimd()
+    {
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        const int maxLeaf = info[0];
+        __cpuid(info, 1);
+        const bool sse41 = (info[2] & (1 << 19)) != 0;
+        const bool osSavesAvx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+        bool avx2 = false;
+        if (maxLeaf >= 7 && osSavesAvx)
+        {
+            __cpuidex(info, 7, 0);
+            avx2 = (info[1] & (1 << 5)) != 0;
+        }
+#else
+        __builtin_cpu_init();
+        const bool sse41 = __builtin_cpu_supports("sse4.1");
+        const bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+        if (avx2)
+            return SimdLevel::AVX2;
+        if (sse41)
+            return SimdLevel::SSE41;
+        return SimdLevel::None;
+    }
+#endif
+
+    // Formats with more than 8 bits per channel
+    bool hasHighPrecision(const QImage &image)
+    {
+        switch (image.format())
+        {
+        case QImage::Format_BGR30:
+        case QImage::Format_A2BGR30_Premultiplied:
+        case QImage::Format_RGB30:
+        case QImage::Format_A2RGB30_Premultiplied:
+        case QImage::Format_Grayscale16:
+            return true;
+        default:
+            return image.depth() > 32;
+        }
+    }
+
+    // Carries the original's metadata over to the 32-bit result and converts
+    // it back to the original's format
+    QImage finishResult(QImage result, const QImage &original)
+    {
+        result.setDotsPerMeterX(original.dotsPerMeterX());
+        result.setDotsPerMeterY(original.dotsPerMeterY());
+        result.setColorSpace(original.colorSpace());
+
+        // Indexed and bit-packed images stay 32-bit, like QImage::scaled()
+        if (original.depth() < 8 || original.format() == QImage::Format_Indexed8 || original.format() == result.format())
+        {
+            return result;
+        }
+        return result.convertToFormat(original.format());
+    }
+
+    // Averages factorX x factorY blocks of a 32-bit image; blocks on the
+    // right and bottom edges may be smaller
+    QImage boxReduce(const QImage &source, int factorX, int factorY, ResamplerKernels::ReduceFn reduce, int threads)
+    {
+        QImage reduced((source.width() + factorX - 1) / factorX, (source.height() + factorY - 1) / factorY, source.format());
+        if (reduced.isNull())
+        {
+            return reduced;
+        }
+
+        const uchar *sourceBits = source.constBits();
+        const qsizetype sourceStride = source.bytesPerLine();
+        uchar *reducedBits = reduced.bits();
+        const qsizetype reducedStride = reduced.bytesPerLine();
+        forEachRowBand(reduced.height(), threads, MinBandRows, [&](int begin, int end)
+                    {
+            std::vector<const std::uint32_t *> rows(factorY);
+            std::vector<std::uint16_t> columnSums(static_cast<size_t>(source.width()) * 4);
+            for (int y = begin; y < end; ++y)
+            {
+                const int first = y * factorY;
+                const int rowCount = std::min(factorY, source.height() - first);
+                for (int r = 0; r < rowCount; ++r)
+                {
+                    rows[r] = reinterpret_cast<const std::uint32_t *>(sourceBits + (first + r) * sourceStride);
+                }
+                auto *out = reinterpret_cast<std::uint32_t *>(reducedBits + y * reducedStride);
+                reduce(rows.data(), rowCount, out, source.width(), factorX, columnSums.data());
+            } });
+        return reduced;
+    }
+}
+
+QImage Resampler::resample(const QImage &image, const QSize &size, const ResampleOptions &options)
+{
+    if (image.isNull() || size.isEmpty())
+    {
+        return QImage();
+    }
+    if (size == image.size())
+    {
+        return image;
+    }
+    if (hasHighPrecision(image))
+    {
+        return image.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    }
+
+    const QImage::Format working = image.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32;
+    QImage source = image.convertToFormat(working);
+    if (source.isNull())
+    {
+        return QImage();
+    }
+
+    const Kernels kernels = kernelsFor(std::min(options.maxSimd, supportedSimd()));
+    const int threads = options.threads;
+    const int width = size.width();
+    const int height = size.height();
+
+    // Large reductions average whole blocks first, a single cheap pass over
+    // the source; the filter then only covers the remaining step
+    QSizeF extent = source.size();
+    const int factorX = options.boxReduction ? reductionFactor(source.width(), width) : 1;
+    const int factorY = options.boxReduction ? reductionFactor(source.height(), height) : 1;
+    if (factorX > 1 || factorY > 1)
+    {
+        extent = QSizeF(static_cast<double>(source.width()) / factorX, static_cast<double>(source.height()) / factorY);
+        source = boxReduce(source, factorX, factorY, kernels.reduce, threads);
+        if (source.isNull())
+        {
+            return QImage();
+        }
+    }
+
+    // A partial edge block still needs a pass to put it in place
+    const bool scaleX = width != source.width() || extent.width() != source.width();
+    const bool scaleY = height != source.height() || extent.height() != source.height();
+    if (!scaleX && !scaleY)
+    {
+        return finishResult(source, image); // Whole blocks gave exactly the requested size
+    }
+    QImage result(size, working);
+    if (result.isNull())
+    {
+        return QImage();
+    }
+
+    // Raw pointers up front: scanLine() may detach, which is not thread-safe
+    const uchar *sourceBits = source.constBits();
+    const qsizetype sourceStride = source.bytesPerLine();
+    uchar *resultBits = result.bits();
+    const qsizetype resultStride = result.bytesPerLine();
+
+    AxisCoefficients vertical;
+    int firstRow = 0;
+    int rowCount = source.height();
+    if (scaleY)
+    {
+        // The horizontal pass only needs the rows the vertical one reads
+        vertical = computeCoefficients(source.height(), extent.height(), height, options.filter);
+        firstRow = vertical.starts.front();
+        rowCount = vertical.starts.back() + vertical.taps - firstRow;
+    }
+
+    std::vector<std::uint32_t> intermediate;
+    if (scaleX)
+    {
+        const AxisCoefficients horizontal = computeCoefficients(source.width(), extent.width(), width, options.filter);
+        if (scaleY)
+        {
+            intermediate.resize(static_cast<size_t>(width) * rowCount);
+        }
+        forEachRowBand(rowCount, threads, MinBandRows, [&](int begin, int end)
+                    {
+            for (int y = begin; y < end; ++y)
+            {
+                const auto *in = reinterpret_cast<const std::uint32_t *>(sourceBits + (firstRow + y) * sourceStride);
+                auto *out = scaleY ? intermediate.data() + static_cast<size_t>(y) * width
+                                   : reinterpret_cast<std::uint32_t *>(resultBits + y * resultStride);
+                kernels.horizontal(in, out, width, horizontal.starts.data(), horizontal.weights.data(), horizontal.taps);
+            } });
+    }
+
+    if (scaleY)
+    {
+        auto rowAt = [&](int row) -> const std::uint32_t *
+        {
+            if (scaleX)
+            {
+                return intermediate.data() + static_cast<size_t>(row - firstRow) * width;
+            }
+            return reinterpret_cast<const std::uint32_t *>(sourceBits + row * sourceStride);
+        };
+        forEachRowBand(height, threads, MinBandRows, [&](int begin, int end)
+                    {
+            std::vector<const std::uint32_t *> rows(vertical.taps);
+            for (int y = begin; y < end; ++y)
+            {
+                for (int k = 0; k < vertical.taps; ++k)
+                {
+                    rows[k] = rowAt(vertical.starts[y] + k);
+                }
+                auto *out = reinterpret_cast<std::uint32_t *>(resultBits + y * resultStride);
+                kernels.vertical(rows.data(), out, width, vertical.weights.data() + static_cast<size_t>(y) * vertical.taps, vertical.taps);
+            } });
+    }
+
+    return finishResult(result, image);
+}
+
+int Resampler::reductionFactor(int inSize, int outSize)
+{
+    if (outSize <= 0)
+    {
+        return 1;
+    }
+    int factor = static_cast<int>(inSize / (outSize * ReducingGap));
+    return std::clamp(factor, 1, ResamplerKernels::MaxReduceFactor);
+}
+
+SimdLevel Resampler::supportedSimd()
+{
+#if defined(EZ_RESAMPLER_X86)
+    static const SimdLevel level = detectSimd();
+    return level;
+#else
+    return SimdLevel::None;
+#endif
+}
+
+QString Resampler::filterName(ResampleFilter filter)
+{
+    switch (filter)
+    {
+    case ResampleFilter::Box:
+        return QStringLiteral("Box");
+    case ResampleFilter::Bilinear:
+        return QStringLiteral("Bilinear");
+    case ResampleFilter::Bicubic:
+        return QStringLiteral("Bicubic");
+    case ResampleFilter::Lanczos3:
+        break;
+    }
+    return QStringLiteral("Lanczos3");
+}
+
+QString Resampler::simdName(SimdLevel level)
+{
+    switch (level)
+    {
+    case SimdLevel::SSE41:
+        return QStringLiteral("SSE4.1");
+    case SimdLevel::AVX2:
+        return QStringLiteral("AVX2");
+    case SimdLevel::None:
+        break;
+    }
+    return QStringLiteral("scalar");
+}
+
+QList<ResampleFilter> Resampler::filters()
+{
+    return {ResampleFilter::Box, ResampleFilter::Bilinear, ResampleFilter::Bicubic, ResampleFilter::Lanczos3};
+}
@@ -0,0 +1,167 @@
+#include "ResamplerKernels.hpp"
+#include <immintrin.h>
+#include <algorithm>
+
+// Compiled with AVX2 enabled; only called when the CPU (and OS) support it
+
+namespace
+{
+    inline int weightPairBits(std::int16_t w0, std::int16_t w1)
+    {
+        return static_cast<int>((std::uint32_t(std::uint16_t(w1)) << 16) | std::uint16_t(w0));
+    }
+
+    inline std::uint32_t packSums(__m128i sums)
+    {
+        sums = _mm_srai_epi32(sums, ResamplerKernels::WeightBits);
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(sums, sums), _mm_setzero_si128());
+        packed = _mm_min_epu8(packed, _mm_shuffle_epi8(packed, _mm_set1_epi8(3)));
+        return static_cast<std::uint32_t>(_mm_cvtsi128_si32(packed));
+    }
+}
+
+void ResamplerKernels::horizontalAVX2(const std::uint32_t *in, std::uint32_t *out, int outWidth,
+                                      const int *starts, const std::int16_t *weights, int taps)
+{
+    // Four pixels as two interleaved pairs: b0 b1 g0 g1 r0 r1 a0 a1 b2 b3 ...
+    const __m128i interleave = _mm_setr_epi8(0, 4, 1, 5, 2, 6, 3, 7, 8, 12, 9, 13, 10, 14, 11, 15);
+
+    for (int x = 0; x < outWidth; ++x)
+    {
+        const std::uint32_t *source = in + starts[x];
+        const std::int16_t *w = weights + static_cast<std::ptrdiff_t>(x) * taps;
+        __m256i wideSums = _mm256_setzero_si256();
+        int k = 0;
+        for (; k + 3 < taps; k += 4)
+        {
+            __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(source + k));
+            __m256i wide = _mm256_cvtepu8_epi16(_mm_shuffle_epi8(pixels, interleave));
+            int pair01 = weightPairBits(w[k], w[k + 1]);
+            int pair23 = weightPairBits(w[k + 2], w[k + 3]);
+            __m256i pairWeights = _mm256_setr_epi32(pair01, pair01, pair01, pair01, pair23, pair23, pair23, pair23);
+            wideSums = _mm256_add_epi32(wideSums, _mm256_madd_epi16(wide, pairWeights));
+        }
+
+        __m128i sums = _mm_add_epi32(_mm_set1_epi32(Rounding),
+                                     _mm_add_epi32(_mm256_castsi256_si128(wideSums), _mm256_extracti128_si256(wideSums, 1)));
+        for (; k < taps; ++k)
+        {
+            __m128i pixel = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(static_cast<int>(source[k])));
+            sums = _mm_add_epi32(sums, _mm_mullo_epi32(pixel, _mm_set1_epi32(w[k])));
+        }
+        out[x] = packSums(sums);
+    }
+}
+
+void ResamplerKernels::verticalAVX2(const std::uint32_t *const *rows, std::uint32_t *out, int width,
+                                    const std::int16_t *weights, int taps)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i alphaLanes = _mm256_setr_epi8(3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15,
+                                                3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15);
+
+    int x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+        // Unpacks work per 128-bit lane, so sums0 holds pixels 0 and 4,
+        // sums1 pixels 1 and 5, and so on; packing restores the order
+        __m256i sums0 = _mm256_set1_epi32(Rounding);
+        __m256i sums1 = sums0;
+        __m256i sums2 = sums0;
+        __m256i sums3 = sums0;
+        for (int k = 0; k < taps; k += 2)
+        {
+            bool pair = k + 1 < taps;
+            __m256i upper = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(rows[k] + x));
+            __m256i lower = pair ? _mm256_loadu_si256(reinterpret_cast<const __m256i *>(rows[k + 1] + x)) : zero;
+            __m256i w = _mm256_set1_epi32(weightPairBits(weights[k], pair ? weights[k + 1] : 0));
+
+            __m256i pixels01 = _mm256_unpacklo_epi8(upper, lower);
+            __m256i pixels23 = _mm256_unpackhi_epi8(upper, lower);
+            sums0 = _mm256_add_epi32(sums0, _mm256_madd_epi16(_mm256_unpacklo_epi8(pixels01, zero), w));
+            sums1 = _mm256_add_epi32(sums1, _mm256_madd_epi16(_mm256_unpackhi_epi8(pixels01, zero), w));
+            sums2 = _mm256_add_epi32(sums2, _mm256_madd_epi16(_mm256_unpacklo_epi8(pixels23, zero), w));
+            sums3 = _mm256_add_epi32(sums3, _mm256_madd_epi16(_mm256_unpackhi_epi8(pixels23, zero), w));
+        }
+
+        sums0 = _mm256_srai_epi32(sums0, WeightBits);
+        sums1 = _mm256_srai_epi32(sums1, WeightBits);
+        sums2 = _mm256_srai_epi32(sums2, WeightBits);
+        sums3 = _mm256_srai_epi32(sums3, WeightBits);
+        __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(sums0, sums1), _mm256_packs_epi32(sums2, sums3));
+        packed = _mm256_min_epu8(packed, _mm256_shuffle_epi8(packed, alphaLanes));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + x), packed);
+    }
+    for (; x < width; ++x)
+    {
+        out[x] = verticalPixel(rows, x, weights, taps);
+    }
+}
+
+void ResamplerKernels::reduceAVX2(const std::uint32_t *const *rows, int rowCount, std::uint32_t *out,
+                                  int inWidth, int factorX, std::uint16_t *columnSums)
+{
+    // Column sums, 32 channel values at a time
+    const int values = inWidth * 4;
+    int i = 0;
+    for (; i + 32 <= values; i += 32)
+    {
+        __m256i low = _mm256_setzero_si256();
+        __m256i high = _mm256_setzero_si256();
+        for (int r = 0; r < rowCount; ++r)
+        {
+            const auto *bytes = reinterpret_cast<const std::uint8_t *>(rows[r]) + i;
+            low = _mm256_add_epi16(low, _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes))));
+            high = _mm256_add_epi16(high, _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + 16))));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(columnSums + i), low);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(columnSums + i + 16), high);
+    }
+    for (; i < values; ++i)
+    {
+        std::uint32_t sum = 0;
+        for (int r = 0; r < rowCount; ++r)
+        {
+            sum += reinterpret_cast<const std::uint8_t *>(rows[r])[i];
+        }
+        columnSums[i] = static_cast<std::uint16_t>(sum);
+    }
+
+    // Two output pixels per step, one per 128-bit lane
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const int outWidth = (inWidth + factorX - 1) / factorX;
+    const int fullBlocks = inWidth / factorX;
+    const float inverseFull = 1.0f / static_cast<float>(factorX * rowCount);
+    int x = 0;
+    for (; x + 2 <= fullBlocks; x += 2)
+    {
+        const std::uint16_t *left = columnSums + x * factorX * 4;
+        const std::uint16_t *right = left + factorX * 4;
+        __m256i sums = _mm256_setzero_si256();
+        for (int c = 0; c < factorX; ++c)
+        {
+            __m128i pair = _mm_unpacklo_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(left + c * 4)),
+                                              _mm_loadl_epi64(reinterpret_cast<const __m128i *>(right + c * 4)));
+            sums = _mm256_add_epi32(sums, _mm256_cvtepu16_epi32(pair));
+        }
+        __m256i means = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(sums), _mm256_set1_ps(inverseFull)), half));
+        __m128i packed = _mm_packs_epi32(_mm256_castsi256_si128(means), _mm256_extracti128_si256(means, 1));
+        packed = _mm_packus_epi16(packed, packed);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(out + x), packed);
+    }
+    for (; x < outWidth; ++x)
+    {
+        const int first = x * factorX;
+        const int columns = std::min(factorX, inWidth - first);
+        std::uint32_t sums[4] = {0, 0, 0, 0};
+        for (int c = 0; c < columns; ++c)
+        {
+            const std::uint16_t *column = columnSums + (first + c) * 4;
+            sums[0] += column[0];
+            sums[1] += column[1];
+            sums[2] += column[2];
+            sums[3] += column[3];
+        }
+        out[x] = averagePixel(sums[0], sums[1], sums[2], sums[3], 1.0f / static_cast<float>(columns * rowCount));
+    }
+}
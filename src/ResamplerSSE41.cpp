@@ -0,0 +1,144 @@
+#include "ResamplerKernels.hpp"
+#include <smmintrin.h>
+#include <algorithm>
+
+// Compiled with SSE4.1 enabled; only called when the CPU supports it
+
+namespace
+{
+    // Two weights for _mm_madd_epi16, repeated in every 32-bit lane
+    inline __m128i weightPair(std::int16_t w0, std::int16_t w1)
+    {
+        return _mm_set1_epi32(static_cast<int>((std::uint32_t(std::uint16_t(w1)) << 16) | std::uint16_t(w0)));
+    }
+
+    // Four 32-bit BGRA sums to one pixel, rounded and clamped
+    inline std::uint32_t packSums(__m128i sums)
+    {
+        sums = _mm_srai_epi32(sums, ResamplerKernels::WeightBits);
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(sums, sums), _mm_setzero_si128());
+        packed = _mm_min_epu8(packed, _mm_shuffle_epi8(packed, _mm_set1_epi8(3)));
+        return static_cast<std::uint32_t>(_mm_cvtsi128_si32(packed));
+    }
+}
+
+void ResamplerKernels::horizontalSSE41(const std::uint32_t *in, std::uint32_t *out, int outWidth,
+                                       const int *starts, const std::int16_t *weights, int taps)
+{
+    // b0 g0 r0 a0 b1 g1 r1 a1 -> b0 b1 g0 g1 r0 r1 a0 a1, so that madd
+    // multiplies two neighbouring pixels by their weights and adds them
+    const __m128i interleave = _mm_setr_epi8(0, 4, 1, 5, 2, 6, 3, 7, -1, -1, -1, -1, -1, -1, -1, -1);
+
+    for (int x = 0; x < outWidth; ++x)
+    {
+        const std::uint32_t *source = in + starts[x];
+        const std::int16_t *w = weights + static_cast<std::ptrdiff_t>(x) * taps;
+        __m128i sums = _mm_set1_epi32(Rounding);
+        int k = 0;
+        for (; k + 1 < taps; k += 2)
+        {
+            __m128i pixels = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(source + k));
+            pixels = _mm_cvtepu8_epi16(_mm_shuffle_epi8(pixels, interleave));
+            sums = _mm_add_epi32(sums, _mm_madd_epi16(pixels, weightPair(w[k], w[k + 1])));
+        }
+        if (k < taps)
+        {
+            __m128i pixel = _mm_cvtsi32_si128(static_cast<int>(source[k]));
+            pixel = _mm_cvtepu8_epi16(_mm_shuffle_epi8(pixel, interleave));
+            sums = _mm_add_epi32(sums, _mm_madd_epi16(pixel, weightPair(w[k], 0)));
+        }
+        out[x] = packSums(sums);
+    }
+}
+
+void ResamplerKernels::verticalSSE41(const std::uint32_t *const *rows, std::uint32_t *out, int width,
+                                     const std::int16_t *weights, int taps)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alphaLanes = _mm_setr_epi8(3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15);
+
+    int x = 0;
+    for (; x + 4 <= width; x += 4)
+    {
+        // One accumulator per pixel, lanes b g r a
+        __m128i sums0 = _mm_set1_epi32(Rounding);
+        __m128i sums1 = sums0;
+        __m128i sums2 = sums0;
+        __m128i sums3 = sums0;
+        for (int k = 0; k < taps; k += 2)
+        {
+            bool pair = k + 1 < taps;
+            __m128i upper = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rows[k] + x));
+            __m128i lower = pair ? _mm_loadu_si128(reinterpret_cast<const __m128i *>(rows[k + 1] + x)) : zero;
+            __m128i w = weightPair(weights[k], pair ? weights[k + 1] : 0);
+
+            // Same channel of the two rows side by side
+            __m128i pixels01 = _mm_unpacklo_epi8(upper, lower);
+            __m128i pixels23 = _mm_unpackhi_epi8(upper, lower);
+            sums0 = _mm_add_epi32(sums0, _mm_madd_epi16(_mm_unpacklo_epi8(pixels01, zero), w));
+            sums1 = _mm_add_epi32(sums1, _mm_madd_epi16(_mm_unpackhi_epi8(pixels01, zero), w));
+            sums2 = _mm_add_epi32(sums2, _mm_madd_epi16(_mm_unpacklo_epi8(pixels23, zero), w));
+            sums3 = _mm_add_epi32(sums3, _mm_madd_epi16(_mm_unpackhi_epi8(pixels23, zero), w));
+        }
+
+        sums0 = _mm_srai_epi32(sums0, WeightBits);
+        sums1 = _mm_srai_epi32(sums1, WeightBits);
+        sums2 = _mm_srai_epi32(sums2, WeightBits);
+        sums3 = _mm_srai_epi32(sums3, WeightBits);
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(sums0, sums1), _mm_packs_epi32(sums2, sums3));
+        packed = _mm_min_epu8(packed, _mm_shuffle_epi8(packed, alphaLanes));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x), packed);
+    }
+    for (; x < width; ++x)
+    {
+        out[x] = verticalPixel(rows, x, weights, taps);
+    }
+}
+
+void ResamplerKernels::reduceSSE41(const std::uint32_t *const *rows, int rowCount, std::uint32_t *out,
+                                   int inWidth, int factorX, std::uint16_t *columnSums)
+{
+    // Column sums, 16 channel values at a time
+    const int values = inWidth * 4;
+    int i = 0;
+    for (; i + 16 <= values; i += 16)
+    {
+        __m128i low = _mm_setzero_si128();
+        __m128i high = _mm_setzero_si128();
+        for (int r = 0; r < rowCount; ++r)
+        {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(reinterpret_cast<const std::uint8_t *>(rows[r]) + i));
+            low = _mm_add_epi16(low, _mm_cvtepu8_epi16(bytes));
+            high = _mm_add_epi16(high, _mm_cvtepu8_epi16(_mm_srli_si128(bytes, 8)));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(columnSums + i), low);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(columnSums + i + 8), high);
+    }
+    for (; i < values; ++i)
+    {
+        std::uint32_t sum = 0;
+        for (int r = 0; r < rowCount; ++r)
+        {
+            sum += reinterpret_cast<const std::uint8_t *>(rows[r])[i];
+        }
+        columnSums[i] = static_cast<std::uint16_t>(sum);
+    }
+
+    const __m128 half = _mm_set1_ps(0.5f);
+    const int outWidth = (inWidth + factorX - 1) / factorX;
+    for (int x = 0; x < outWidth; ++x)
+    {
+        const int first = x * factorX;
+        const int columns = std::min(factorX, inWidth - first);
+        __m128i sums = _mm_setzero_si128();
+        for (int c = 0; c < columns; ++c)
+        {
+            __m128i column = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(columnSums + (first + c) * 4));
+            sums = _mm_add_epi32(sums, _mm_cvtepu16_epi32(column));
+        }
+        __m128 inverseArea = _mm_set1_ps(1.0f / static_cast<float>(columns * rowCount));
+        __m128i means = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(sums), inverseArea), half));
+        means = _mm_packus_epi16(_mm_packs_epi32(means, means), means);
+        out[x] = static_cast<std::uint32_t>(_mm_cvtsi128_si32(means));
+    }
+}
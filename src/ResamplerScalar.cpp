@@ -0,0 +1,64 @@
+#include "ResamplerKernels.hpp"
+#include <algorithm>
+
+void ResamplerKernels::horizontalScalar(const std::uint32_t *in, std::uint32_t *out, int outWidth,
+                                        const int *starts, const std::int16_t *weights, int taps)
+{
+    for (int x = 0; x < outWidth; ++x)
+    {
+        const std::uint32_t *source = in + starts[x];
+        const std::int16_t *w = weights + static_cast<std::ptrdiff_t>(x) * taps;
+        int b = Rounding, g = Rounding, r = Rounding, a = Rounding;
+        for (int k = 0; k < taps; ++k)
+        {
+            std::uint32_t pixel = source[k];
+            b += w[k] * int(pixel & 0xff);
+            g += w[k] * int((pixel >> 8) & 0xff);
+            r += w[k] * int((pixel >> 16) & 0xff);
+            a += w[k] * int(pixel >> 24);
+        }
+        out[x] = packPixel(b, g, r, a);
+    }
+}
+
+void ResamplerKernels::verticalScalar(const std::uint32_t *const *rows, std::uint32_t *out, int width,
+                                      const std::int16_t *weights, int taps)
+{
+    for (int x = 0; x < width; ++x)
+    {
+        out[x] = verticalPixel(rows, x, weights, taps);
+    }
+}
+
+void ResamplerKernels::reduceScalar(const std::uint32_t *const *rows, int rowCount, std::uint32_t *out,
+                                    int inWidth, int factorX, std::uint16_t *columnSums)
+{
+    // Rows first: one sequential sweep over each source row
+    const int values = inWidth * 4;
+    std::fill(columnSums, columnSums + values, std::uint16_t(0));
+    for (int r = 0; r < rowCount; ++r)
+    {
+        const auto *bytes = reinterpret_cast<const std::uint8_t *>(rows[r]);
+        for (int i = 0; i < values; ++i)
+        {
+            columnSums[i] = static_cast<std::uint16_t>(columnSums[i] + bytes[i]);
+        }
+    }
+
+    const int outWidth = (inWidth + factorX - 1) / factorX;
+    for (int x = 0; x < outWidth; ++x)
+    {
+        const int first = x * factorX;
+        const int columns = std::min(factorX, inWidth - first);
+        std::uint32_t sums[4] = {0, 0, 0, 0};
+        for (int c = 0; c < columns; ++c)
+        {
+            const std::uint16_t *column = columnSums + (first + c) * 4;
+            sums[0] += column[0];
+            sums[1] += column[1];
+            sums[2] += column[2];
+            sums[3] += column[3];
+        }
+        out[x] = averagePixel(sums[0], sums[1], sums[2], sums[3], 1.0f / static_cast<float>(columns * rowCount));
+    }
+}
@@ -1,10 +1,11 @@
 #include "ResizeTool.hpp"
 #include "ImageEditor.hpp"
+#include "TiledImage.hpp"
 #include <QtWidgets/QMessageBox>
 #include <QtGui/QImage>
 
 ResizeTool::ResizeTool(QObject *parent)
-    : QObject(parent), m_editor(nullptr), m_resizeGroup(nullptr), m_widthSpinBox(nullptr), m_heightSpinBox(nullptr), m_aspectRatioCheckBox(nullptr)
+    : QObject(parent), m_editor(nullptr), m_resizeGroup(nullptr), m_widthSpinBox(nullptr), m_heightSpinBox(nullptr), m_aspectRatioCheckBox(nullptr), m_filterComboBox(nullptr), m_methodLabel(nullptr)
 {
 }
 
@@ -18,7 +19,7 @@ QWidget *ResizeTool::getToolWidget()
         QHBoxLayout *widthLayout = new QHBoxLayout();
         QLabel *widthLabel = new QLabel(tr("Width:"));
         m_widthSpinBox = new QSpinBox();
-        m_widthSpinBox->setRange(1, 10000);
+        m_widthSpinBox->setRange(1, TiledImage::MaxSide);
         widthLayout->addWidget(widthLabel);
         widthLayout->addWidget(m_widthSpinBox);
         resizeLayout->addLayout(widthLayout);
@@ -26,7 +27,7 @@ QWidget *ResizeTool::getToolWidget()
         QHBoxLayout *heightLayout = new QHBoxLayout();
         QLabel *heightLabel = new QLabel(tr("Height:"));
         m_heightSpinBox = new QSpinBox();
-        m_heightSpinBox->setRange(1, 10000);
+        m_heightSpinBox->setRange(1, TiledImage::MaxSide);
         heightLayout->addWidget(heightLabel);
         heightLayout->addWidget(m_heightSpinBox);
         resizeLayout->addLayout(heightLayout);
@@ -35,18 +36,40 @@ QWidget *ResizeTool::getToolWidget()
         m_aspectRatioCheckBox->setChecked(true); // Default to true
         resizeLayout->addWidget(m_aspectRatioCheckBox);
 
+        QHBoxLayout *filterLayout = new QHBoxLayout();
+        QLabel *filterLabel = new QLabel(tr("Filter:"));
+        m_filterComboBox = new QComboBox();
+        for (ResampleFilter filter : Resampler::filters())
+        {
+            m_filterComboBox->addItem(Resampler::filterName(filter), static_cast<int>(filter));
+        }
+        m_filterComboBox->setCurrentIndex(m_filterComboBox->findData(static_cast<int>(ResampleFilter::Lanczos3)));
+        m_filterComboBox->setToolTip(tr("Box is fastest; Lanczos3 keeps the most detail"));
+        filterLayout->addWidget(filterLabel);
+        filterLayout->addWidget(m_filterComboBox);
+        resizeLayout->addLayout(filterLayout);
+
+        // Large reductions take the box-averaging fast path automatically
+        m_methodLabel = new QLabel();
+        m_methodLabel->setWordWrap(true);
+        m_methodLabel->hide();
+        resizeLayout->addWidget(m_methodLabel);
+        connect(m_widthSpinBox, QOverload<int>::of(&QSpinBox::valueChanged), this, &ResizeTool::updateMethodHint);
+        connect(m_heightSpinBox, QOverload<int>::of(&QSpinBox::valueChanged), this, &ResizeTool::updateMethodHint);
+        connect(m_filterComboBox, QOverload<int>::of(&QComboBox::currentIndexChanged), this, &ResizeTool::updateMethodHint);
+
         // Connect signals for aspect ratio maintenance
         connect(m_widthSpinBox, QOverload<int>::of(&QSpinBox::valueChanged), this, [this](int value)
                 {
-            if (m_aspectRatioCheckBox->isChecked() && m_editor && !m_editor->getCurrentImage().isNull()) {
-                double ratio = static_cast<double>(m_editor->getCurrentImage().width()) / m_editor->getCurrentImage().height();
+            if (m_aspectRatioCheckBox->isChecked() && m_editor && m_editor->hasImage()) {
+                double ratio = static_cast<double>(m_editor->getCurrentSize().width()) / m_editor->getCurrentSize().height();
                 m_heightSpinBox->setValue(qRound(value / ratio));
             } });
 
         connect(m_heightSpinBox, QOverload<int>::of(&QSpinBox::valueChanged), this, [this](int value)
                 {
-            if (m_aspectRatioCheckBox->isChecked() && m_editor && !m_editor->getCurrentImage().isNull()) {
-                double ratio = static_cast<double>(m_editor->getCurrentImage().width()) / m_editor->getCurrentImage().height();
+            if (m_aspectRatioCheckBox->isChecked() && m_editor && m_editor->hasImage()) {
+                double ratio = static_cast<double>(m_editor->getCurrentSize().width()) / m_editor->getCurrentSize().height();
                 m_widthSpinBox->setValue(qRound(value * ratio));
             } });
 
@@ -68,21 +91,51 @@ void ResizeTool::setImageEditor(ImageEditor *editor)
     // Update spin box values when image changes
     connect(m_editor, &ImageEditor::imageChanged, this, [this]()
             {
-        if (m_editor && !m_editor->getCurrentImage().isNull()) {
-            m_widthSpinBox->setValue(m_editor->getCurrentImage().width());
-            m_heightSpinBox->setValue(m_editor->getCurrentImage().height());
-        } });
+        if (m_editor && m_editor->hasImage()) {
+            m_widthSpinBox->setValue(m_editor->getCurrentSize().width());
+            m_heightSpinBox->setValue(m_editor->getCurrentSize().height());
+        }
+        updateMethodHint(); });
 }
 
 void ResizeTool::resizeImage()
 {
-    if (!m_editor || m_editor->getCurrentImage().isNull())
+    if (!m_editor || !m_editor->hasImage())
     {
         return;
     }
 
     QSize newSize(m_widthSpinBox->value(), m_heightSpinBox->value());
-    QImage resizedImage = m_editor->getCurrentImage().scaled(newSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
-    m_editor->setCurrentImage(resizedImage);
+    ResampleFilter filter = static_cast<ResampleFilter>(m_filterComboBox->currentData().toInt());
+    // Previewed at screen resolution, resampled from the source on save
+    m_editor->resizeImage(newSize, filter);
     m_editor->updateDisplay();
-}
\ No newline at end of file
+}
+
+void ResizeTool::updateMethodHint()
+{
+    if (!m_methodLabel)
+    {
+        return;
+    }
+    int factorX = 1;
+    int factorY = 1;
+    if (m_editor && m_editor->hasImage())
+    {
+        // Resampling starts from the unscaled crop, not from the preview size
+        QSize unscaled = m_editor->getPendingEdits().orientation().mapSize(m_editor->getPendingEdits().sourceRect().size());
+        factorX = Resampler::reductionFactor(unscaled.width(), m_widthSpinBox->value());
+        factorY = Resampler::reductionFactor(unscaled.height(), m_heightSpinBox->value());
+    }
+    if (factorX == 1 && factorY == 1)
+    {
+        m_methodLabel->clear();
+        m_methodLabel->hide();
+        return;
+    }
+    m_methodLabel->setText(tr("Large reduction: averages %1x%2 blocks, then applies %3")
+                               .arg(factorX)
+                               .arg(factorY)
+                               .arg(m_filterComboBox->currentText()));
+    m_methodLabel->show();
+}
@@ -1,6 +1,6 @@
 #include "RotateFlipTool.hpp"
 #include "ImageEditor.hpp"
-#include <QtGui/QTransform>
+#include "EditPipeline.hpp"
 #include <QtGui/QImage>
 
 RotateFlipTool::RotateFlipTool(QObject *parent)
@@ -46,48 +46,41 @@ void RotateFlipTool::setImageEditor(ImageEditor *editor)
 
 void RotateFlipTool::rotateLeft()
 {
-    if (!m_editor || m_editor->getCurrentImage().isNull())
+    if (!m_editor || !m_editor->hasImage())
     {
         return;
     }
-    QTransform transform;
-    transform.rotate(-90);
-    QImage rotatedImage = m_editor->getCurrentImage().transformed(transform);
-    m_editor->setCurrentImage(rotatedImage);
+    // Recorded, not applied: consecutive rotations and flips fuse into one pass
+    m_editor->orientImage(Orientation::rotation(-90));
     m_editor->updateDisplay();
 }
 
 void RotateFlipTool::rotateRight()
 {
-    if (!m_editor || m_editor->getCurrentImage().isNull())
+    if (!m_editor || !m_editor->hasImage())
     {
         return;
     }
-    QTransform transform;
-    transform.rotate(90);
-    QImage rotatedImage = m_editor->getCurrentImage().transformed(transform);
-    m_editor->setCurrentImage(rotatedImage);
+    m_editor->orientImage(Orientation::rotation(90));
     m_editor->updateDisplay();
 }
 
 void RotateFlipTool::flipHorizontal()
 {
-    if (!m_editor || m_editor->getCurrentImage().isNull())
+    if (!m_editor || !m_editor->hasImage())
     {
         return;
     }
-    QImage flippedImage = m_editor->getCurrentImage().flipped(Qt::Horizontal);
-    m_editor->setCurrentImage(flippedImage);
+    m_editor->orientImage(Orientation::flip(Qt::Horizontal));
     m_editor->updateDisplay();
 }
 
 void RotateFlipTool::flipVertical()
 {
-    if (!m_editor || m_editor->getCurrentImage().isNull())
+    if (!m_editor || !m_editor->hasImage())
     {
         return;
     }
-    QImage flippedImage = m_editor->getCurrentImage().flipped(Qt::Vertical);
-    m_editor->setCurrentImage(flippedImage);
+    m_editor->orientImage(Orientation::flip(Qt::Vertical));
     m_editor->updateDisplay();
-}
\ No newline at end of file
+}
@@ -0,0 +1,449 @@
+#include "ScanlineReader.hpp"
+#include <QtCore/QFile>
+#include <QtCore/QtEndian>
+#include <csetjmp>
+#include <cstdio>
+#include <vector>
+#ifdef EZ_HAVE_LIBPNG
+#include <png.h>
+#endif
+#ifdef EZ_HAVE_LIBJPEG
+#include <jpeglib.h>
+#endif
+
+// libpng and libjpeg report errors by longjmp() back to the setjmp() of
+// the caller; the functions calling setjmp() here keep no locals with
+// destructors past that point, so the jump skips nothing
+
+namespace
+{
+    // Bytes of the longest signature looked at by open()
+    const int SignatureBytes = 8;
+
+    // Rows of a BI_RGB or plain BI_BITFIELDS BMP, seeked to and read band
+    // by band; bottom-up files are read the same way, the band reversed
+    class BmpReader : public ScanlineReader
+    {
+    public:
+        static std::unique_ptr<ScanlineReader> open(const QString &filename)
+        {
+            std::unique_ptr<BmpReader> reader(new BmpReader(filename));
+            if (!reader->m_file.open(QIODevice::ReadOnly) || !reader->readHeader())
+            {
+                return nullptr;
+            }
+            return reader;
+        }
+
+    protected:
+        bool readRows(QImage &rows) override
+        {
+            // File rows of the band, in file order
+            const int count = rows.height();
+            const int first = m_bottomUp ? m_height - nextRow() - count : nextRow();
+            m_buffer.resize(static_cast<size_t>(count) * m_stride);
+            const qint64 bytes = qint64(m_buffer.size());
+            if (!m_file.seek(m_pixelOffset + qint64(first) * m_stride) ||
+                m_file.read(reinterpret_cast<char *>(m_buffer.data()), bytes) != bytes)
+            {
+                return false;
+            }
+
+            for (int y = 0; y < count; ++y)
+            {
+                const uchar *in = m_buffer.data() + static_cast<size_t>(m_bottomUp ? count - 1 - y : y) * m_stride;
+                QRgb *out = reinterpret_cast<QRgb *>(rows.scanLine(y));
+                const int width = rows.width();
+                if (m_bitCount == 24)
+                {
+                    for (int x = 0; x < width; ++x, in += 3)
+                    {
+                        out[x] = qRgb(in[2], in[1], in[0]);
+                    }
+                }
+                else
+                {
+                    for (int x = 0; x < width; ++x, in += 4)
+                    {
+                        out[x] = qRgba(in[2], in[1], in[0], hasAlpha() ? in[3] : 0xff);
+                    }
+                }
+            }
+            return true;
+        }
+
+    private:
+        explicit BmpReader(const QString &filename) : m_file(filename) {}
+
+        bool readHeader()
+        {
+            // File header, then an info header of at least 40 bytes whose
+            // first 56 hold everything looked at
+            uchar header[14 + 56] = {};
+            const qint64 length = m_file.read(reinterpret_cast<char *>(header), sizeof(header));
+            if (length < 14 + 40 || header[0] != 'B' || header[1] != 'M')
+            {
+                return false;
+            }
+            m_pixelOffset = qFromLittleEndian<quint32>(header + 10);
+            const quint32 infoSize = qFromLittleEndian<quint32>(header + 14);
+            const qint32 width = qFromLittleEndian<qint32>(header + 18);
+            const qint32 height = qFromLittleEndian<qint32>(header + 22);
+            m_bitCount = qFromLittleEndian<quint16>(header + 28);
+            const quint32 compression = qFromLittleEndian<quint32>(header + 30);
+            if (infoSize < 40 || width <= 0 || height == 0 || height < -MaxSide || height > MaxSide ||
+                width > MaxSide || (m_bitCount != 24 && m_bitCount != 32))
+            {
+                return false;
+            }
+
+            bool alpha = false;
+            if (compression == 3) // BI_BITFIELDS
+            {
+                // Masks follow a 40-byte header and are part of larger ones;
+                // only the byte order BI_RGB has is read
+                const quint32 red = qFromLittleEndian<quint32>(header + 54);
+                const quint32 green = qFromLittleEndian<quint32>(header + 58);
+                const quint32 blue = qFromLittleEndian<quint32>(header + 62);
+                if (m_bitCount != 32 || length < 14 + 52 || red != 0x00ff0000 || green != 0x0000ff00 || blue != 0x000000ff)
+                {
+                    return false;
+                }
+                alpha = infoSize >= 56 && length >= 14 + 56 && qFromLittleEndian<quint32>(header + 66) == 0xff000000;
+            }
+            else if (compression != 0) // BI_RGB
+            {
+                return false;
+            }
+
+            m_bottomUp = height > 0;
+            m_height = m_bottomUp ? height : -height;
+            m_stride = (qint64(width) * m_bitCount + 31) / 32 * 4;
+            if (m_file.size() < m_pixelOffset + m_stride * m_height)
+            {
+                return false;
+            }
+            setFormat(QSize(width, m_height), alpha);
+            return true;
+        }
+
+        // Larger sides than this are rejected as corrupt, not read
+        static constexpr qint32 MaxSide = 1 << 24;
+
+        QFile m_file;
+        qint64 m_pixelOffset = 0;
+        qint64 m_stride = 0;
+        int m_height = 0;
+        int m_bitCount = 0;
+        bool m_bottomUp = true;
+        std::vector<uchar> m_buffer;
+    };
+
+#ifdef EZ_HAVE_LIBPNG
+    // Rows of a non-interlaced PNG, expanded to 8-bit RGBA or RGBX
+    class PngReader : public ScanlineReader
+    {
+    public:
+        static std::unique_ptr<ScanlineReader> open(const QString &filename)
+        {
+            std::unique_ptr<PngReader> reader(new PngReader(filename));
+            if (!reader->m_file.open(QIODevice::ReadOnly) || !reader->m_info || !reader->readHeader())
+            {
+                return nullptr;
+            }
+            return reader;
+        }
+
+        ~PngReader() override
+        {
+            png_destroy_read_struct(&m_png, &m_info, nullptr);
+        }
+
+    protected:
+        bool readRows(QImage &rows) override
+        {
+            if (setjmp(png_jmpbuf(m_png)))
+            {
+                return false;
+            }
+            for (int y = 0; y < rows.height(); ++y)
+            {
+                png_read_row(m_png, rows.scanLine(y), nullptr);
+            }
+
+            // The RGBA bytes become QRgb in place
+            for (int y = 0; y < rows.height(); ++y)
+            {
+                uchar *row = rows.scanLine(y);
+                QRgb *out = reinterpret_cast<QRgb *>(row);
+                for (int x = 0; x < rows.width(); ++x, row += 4)
+                {
+                    out[x] = qRgba(row[0], row[1], row[2], row[3]);
+                }
+            }
+            return true;
+        }
+
+    private:
+        explicit PngReader(const QString &filename) : m_file(filename)
+        {
+            m_png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, fail, ignoreWarning);
+            m_info = m_png ? png_create_info_struct(m_png) : nullptr;
+        }
+
+        // Like libpng's own handler, without the message on stderr
+        [[noreturn]] static void fail(png_structp png, png_const_charp)
+        {
+            png_longjmp(png, 1);
+        }
+
+        static void ignoreWarning(png_structp, png_const_charp) {}
+
+        static void readData(png_structp png, png_bytep data, png_size_t length)
+        {
+            QFile *file = static_cast<QFile *>(png_get_io_ptr(png));
+            if (file->read(reinterpret_cast<char *>(data), qint64(length)) != qint64(length))
+            {
+                png_error(png, "Unexpected end of file");
+            }
+        }
+
+        bool readHeader()
+        {
+            if (setjmp(png_jmpbuf(m_png)))
+            {
+                return false;
+            }
+            png_set_read_fn(m_png, &m_file, readData);
+            png_read_info(m_png, m_info);
+            // The passes of an interlaced file each cover the whole image
+            if (png_get_interlace_type(m_png, m_info) != PNG_INTERLACE_NONE)
+            {
+                return false;
+            }
+
+            const int colorType = png_get_color_type(m_png, m_info);
+            const bool alpha = (colorType & PNG_COLOR_MASK_ALPHA) || png_get_valid(m_png, m_info, PNG_INFO_tRNS);
+            png_set_expand(m_png);
+            png_set_strip_16(m_png);
+            if (!(colorType & PNG_COLOR_MASK_COLOR))
+            {
+                png_set_gray_to_rgb(m_png);
+            }
+            if (!alpha)
+            {
+                png_set_filler(m_png, 0xff, PNG_FILLER_AFTER);
+            }
+            png_read_update_info(m_png, m_info);
+
+            const png_uint_32 width = png_get_image_width(m_png, m_info);
+            const png_uint_32 height = png_get_image_height(m_png, m_info);
+            if (png_get_rowbytes(m_png, m_info) != png_size_t(width) * 4 || width > 0x7fffffff || height > 0x7fffffff)
+            {
+                return false;
+            }
+            setFormat(QSize(int(width), int(height)), alpha);
+            return true;
+        }
+
+        QFile m_file;
+        png_structp m_png = nullptr;
+        png_infop m_info = nullptr;
+    };
+#endif
+
+#ifdef EZ_HAVE_LIBJPEG
+    // Rows of a baseline JPEG, decoded in order through a source manager
+    // that reads the file a buffer at a time
+    class JpegReader : public ScanlineReader
+    {
+    public:
+        static std::unique_ptr<ScanlineReader> open(const QString &filename)
+        {
+            std::unique_ptr<JpegReader> reader(new JpegReader(filename));
+            if (!reader->m_file.open(QIODevice::ReadOnly) || !reader->start())
+            {
+                return nullptr;
+            }
+            return reader;
+        }
+
+        ~JpegReader() override
+        {
+            jpeg_destroy_decompress(&m_jpeg);
+        }
+
+    protected:
+        bool readRows(QImage &rows) override
+        {
+            if (setjmp(m_error.jump))
+            {
+                return false;
+            }
+            for (int y = 0; y < rows.height(); ++y)
+            {
+                JSAMPROW row = m_row.data();
+                if (jpeg_read_scanlines(&m_jpeg, &row, 1) != 1)
+                {
+                    return false;
+                }
+                const JSAMPLE *in = m_row.data();
+                QRgb *out = reinterpret_cast<QRgb *>(rows.scanLine(y));
+                for (int x = 0; x < rows.width(); ++x, in += 3)
+                {
+                    out[x] = qRgb(in[0], in[1], in[2]);
+                }
+            }
+            return true;
+        }
+
+    private:
+        struct Error
+        {
+            jpeg_error_mgr manager;
+            std::jmp_buf jump;
+        };
+
+        struct Source
+        {
+            jpeg_source_mgr manager;
+            QFile *file;
+            JOCTET buffer[64 * 1024];
+        };
+
+        explicit JpegReader(const QString &filename) : m_file(filename)
+        {
+            m_jpeg.err = jpeg_std_error(&m_error.manager);
+            m_error.manager.error_exit = [](j_common_ptr jpeg)
+            {
+                std::longjmp(reinterpret_cast<Error *>(jpeg->err)->jump, 1);
+            };
+            m_error.manager.output_message = [](j_common_ptr) {};
+            m_source.file = &m_file;
+            m_source.manager.next_input_byte = nullptr;
+            m_source.manager.bytes_in_buffer = 0;
+            m_source.manager.init_source = [](j_decompress_ptr) {};
+            m_source.manager.fill_input_buffer = fillInputBuffer;
+            m_source.manager.skip_input_data = [](j_decompress_ptr jpeg, long count)
+            {
+                jpeg_source_mgr *source = jpeg->src;
+                while (count > long(source->bytes_in_buffer))
+                {
+                    count -= long(source->bytes_in_buffer);
+                    fillInputBuffer(jpeg);
+                }
+                if (count > 0)
+                {
+                    source->next_input_byte += count;
+                    source->bytes_in_buffer -= size_t(count);
+                }
+            };
+            m_source.manager.resync_to_restart = jpeg_resync_to_restart;
+            m_source.manager.term_source = [](j_decompress_ptr) {};
+        }
+
+        static boolean fillInputBuffer(j_decompress_ptr jpeg)
+        {
+            Source *source = reinterpret_cast<Source *>(jpeg->src);
+            qint64 length = source->file->read(reinterpret_cast<char *>(source->buffer), sizeof(source->buffer));
+            if (length <= 0)
+            {
+                // A truncated file ends as if it were complete, as in libjpeg's own sources
+                source->buffer[0] = 0xff;
+                source->buffer[1] = JPEG_EOI;
+                length = 2;
+            }
+            source->manager.next_input_byte = source->buffer;
+            source->manager.bytes_in_buffer = size_t(length);
+            return TRUE;
+        }
+
+        bool start()
+        {
+            if (setjmp(m_error.jump))
+            {
+                return false;
+            }
+            // Created here, where its errors can jump to; destroying the
+            // zeroed struct of a failed creation does nothing
+            jpeg_create_decompress(&m_jpeg);
+            m_jpeg.src = &m_source.manager;
+            jpeg_read_header(&m_jpeg, TRUE);
+            // Progressive files buffer every coefficient of the image before
+            // the first row; CMYK needs the inversion Qt's reader applies
+            if (m_jpeg.progressive_mode || m_jpeg.jpeg_color_space == JCS_CMYK || m_jpeg.jpeg_color_space == JCS_YCCK)
+            {
+                return false;
+            }
+            m_jpeg.out_color_space = JCS_RGB;
+            jpeg_start_decompress(&m_jpeg);
+            if (m_jpeg.output_components != 3)
+            {
+                return false;
+            }
+            setFormat(QSize(int(m_jpeg.output_width), int(m_jpeg.output_height)), false);
+            m_row.resize(static_cast<size_t>(m_jpeg.output_width) * 3);
+            return true;
+        }
+
+        QFile m_file;
+        jpeg_decompress_struct m_jpeg = {};
+        Error m_error = {};
+        Source m_source = {};
+        std::vector<JSAMPLE> m_row;
+    };
+#endif
+}
+
+std::unique_ptr<ScanlineReader> ScanlineReader::open(const QString &filename)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        return nullptr;
+    }
+    const QByteArray signature = file.read(SignatureBytes);
+    file.close();
+
+    if (signature.startsWith("BM"))
+    {
+        return BmpReader::open(filename);
+    }
+#ifdef EZ_HAVE_LIBPNG
+    if (signature.startsWith("\x89PNG\r\n\x1a\n"))
+    {
+        return PngReader::open(filename);
+    }
+#endif
+#ifdef EZ_HAVE_LIBJPEG
+    if (signature.startsWith("\xff\xd8\xff"))
+    {
+        return JpegReader::open(filename);
+    }
+#endif
+    return nullptr;
+}
+
+void ScanlineReader::setFormat(const QSize &size, bool hasAlpha)
+{
+    m_size = size;
+    m_hasAlpha = hasAlpha;
+}
+
+QImage ScanlineReader::read(int count)
+{
+    const int rows = qMin(count, m_size.height() - m_nextRow);
+    if (rows <= 0)
+    {
+        return QImage();
+    }
+    QImage band(m_size.width(), rows, m_hasAlpha ? QImage::Format_ARGB32 : QImage::Format_RGB32);
+    if (band.isNull() || !readRows(band))
+    {
+        // A failed decoder cannot pick up where it stopped
+        m_nextRow = m_size.height();
+        return QImage();
+    }
+    m_nextRow += rows;
+    return band;
+}
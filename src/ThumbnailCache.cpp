@@ -0,0 +1,210 @@
+#include "ThumbnailCache.hpp"
+#include "ImageLoader.hpp"
+#include "Resampler.hpp"
+#include "TiledImage.hpp"
+#include "WebPHandler.hpp"
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QStandardPaths>
+#include <QtCore/QThread>
+#include <limits>
+
+namespace
+{
+    // Bumped when thumbnails are made differently, so old files are not used
+    const int DiskFormatVersion = 1;
+
+    // Thumbnails delivered between two prunings of the disk cache; a few
+    // hundred files of a few KiB each cannot get far past the budget
+    const int PruneInterval = 256;
+
+    int costOf(const QImage &image)
+    {
+        return static_cast<int>(qMax<qsizetype>(1, image.sizeInBytes() / 1024));
+    }
+}
+
+ThumbnailCache::ThumbnailCache(QObject *parent)
+    : QObject(parent), m_directory(diskCacheDirectory()), m_diskBudget(DefaultDiskBudget), m_sincePrune(0)
+{
+    setMemoryBudget(DefaultMemoryBudget);
+    QDir().mkpath(m_directory);
+
+    // One core is left for the GUI and the decode of the open file
+    m_pool.setMaxThreadCount(qMax(1, QThread::idealThreadCount() - 1));
+    m_pool.setThreadPriority(QThread::LowPriority);
+
+    // Whatever earlier sessions left behind
+    schedulePrune();
+}
+
+ThumbnailCache::~ThumbnailCache()
+{
+    // Results still queued to this object are discarded with it
+    m_pool.clear();
+    m_pool.waitForDone();
+}
+
+void ThumbnailCache::setMemoryBudget(qint64 bytes)
+{
+    m_memory.setMaxCost(static_cast<qsizetype>(qMax<qint64>(0, bytes) / 1024));
+}
+
+void ThumbnailCache::setDiskBudget(qint64 bytes)
+{
+    m_diskBudget = qMax<qint64>(0, bytes);
+}
+
+QImage ThumbnailCache::request(const QString &filename, int priority)
+{
+    QFileInfo info(filename);
+    if (!info.isFile())
+    {
+        return QImage();
+    }
+    const QString key = cacheKey(info);
+    if (QImage *thumbnail = m_memory.object(key))
+    {
+        return *thumbnail;
+    }
+    if (m_pending.contains(key))
+    {
+        return QImage();
+    }
+    m_pending.insert(key);
+
+    const QString diskPath = QDir(m_directory).filePath(key + ".webp");
+    m_pool.start([this, filename, key, diskPath]()
+                 {
+        QImage thumbnail = loadOrGenerate(filename, diskPath);
+        QMetaObject::invokeMethod(this, [this, filename, key, thumbnail]()
+                                  {
+            m_pending.remove(key);
+            if (!thumbnail.isNull())
+            {
+                m_memory.insert(key, new QImage(thumbnail), costOf(thumbnail));
+            }
+            if (++m_sincePrune >= PruneInterval)
+            {
+                schedulePrune();
+            }
+            emit thumbnailReady(filename, thumbnail); }, Qt::QueuedConnection); },
+                 priority);
+    return QImage();
+}
+
+void ThumbnailCache::cancelPending()
+{
+    // Running requests still finish and are cached; one asked for again
+    // meanwhile is generated twice, which is harmless. A pruning that was
+    // cleared too is queued again after the next interval.
+    m_pool.clear();
+    m_pending.clear();
+}
+
+void ThumbnailCache::schedulePrune()
+{
+    m_sincePrune = 0;
+    const QString directory = m_directory;
+    const qint64 budget = m_diskBudget;
+    m_pool.start([directory, budget]()
+                 { pruneDirectory(directory, budget); },
+                 std::numeric_limits<int>::min());
+}
+
+void ThumbnailCache::pruneDirectory(const QString &directory, qint64 bytes)
+{
+    // Hits refresh a file's modification time, so the oldest are the least
+    // recently used. A file deleted while it is being read or written only
+    // costs generating that thumbnail again.
+    const QFileInfoList files = QDir(directory).entryInfoList({"*.webp"}, QDir::Files, QDir::Time);
+    qint64 total = 0;
+    for (const QFileInfo &file : files)
+    {
+        total += file.size();
+    }
+    for (auto file = files.crbegin(); file != files.crend() && total > bytes; ++file)
+    {
+        if (QFile::remove(file->filePath()))
+        {
+            total -= file->size();
+        }
+    }
+}
+
+QString ThumbnailCache::diskCacheDirectory()
+{
+    return QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).filePath("thumbnails");
+}
+
+QString ThumbnailCache::cacheKey(const QFileInfo &info)
+{
+    QByteArray identity = QString("%1|%2|%3|%4|%5")
+                              .arg(info.absoluteFilePath())
+                              .arg(info.size())
+                              .arg(info.lastModified().toMSecsSinceEpoch())
+                              .arg(Edge)
+                              .arg(DiskFormatVersion)
+                              .toUtf8();
+    return QString::fromLatin1(QCryptographicHash::hash(identity, QCryptographicHash::Sha1).toHex());
+}
+
+QImage ThumbnailCache::loadOrGenerate(const QString &filename, const QString &diskPath)
+{
+    if (QFileInfo::exists(diskPath))
+    {
+        QImage thumbnail = WebPHandler::decode(diskPath);
+        if (!thumbnail.isNull())
+        {
+            // Marks it recently used for pruning
+            QFile file(diskPath);
+            if (file.open(QIODevice::ReadWrite))
+            {
+                file.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+            }
+            return thumbnail;
+        }
+    }
+
+    QImage thumbnail = generate(filename);
+    if (!thumbnail.isNull())
+    {
+        // Written to a temporary file first, so a concurrent reader never
+        // sees half of it; a failed write only costs regenerating later
+        WebPEncodeOptions options;
+        options.profile = WebPEncodeProfile::Fast;
+        options.quality = 80;
+        WebPHandler::encode(thumbnail, diskPath, options);
+    }
+    return thumbnail;
+}
+
+QImage ThumbnailCache::generate(const QString &filename)
+{
+    // With the size from the header the decoder does the reduction
+    // (libwebp, or JPEG in the DCT domain); otherwise it is done after
+    const QSize fullSize = ImageLoader::imageSize(filename);
+    if (TiledImage::needsTiling(fullSize) && !ImageLoader::canDecodeScaled(filename))
+    {
+        return QImage(); // Would have to be decoded whole, which does not fit
+    }
+    const QSize bounds(Edge, Edge);
+    DecodeOptions options;
+    if (fullSize.isValid() && (fullSize.width() > Edge || fullSize.height() > Edge))
+    {
+        options.size = fullSize.scaled(bounds, Qt::KeepAspectRatio).expandedTo(QSize(1, 1));
+    }
+    QImage image = ImageLoader::loadImage(filename, options);
+    if (image.isNull() || (image.width() <= Edge && image.height() <= Edge))
+    {
+        return image;
+    }
+
+    ResampleOptions resample;
+    resample.filter = ResampleFilter::Bilinear;
+    resample.threads = 1; // The pool already runs one thumbnail per core
+    return Resampler::resample(image, image.size().scaled(bounds, Qt::KeepAspectRatio).expandedTo(QSize(1, 1)), resample);
+}
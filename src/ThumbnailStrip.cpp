@@ -0,0 +1,80 @@
+#include "ThumbnailStrip.hpp"
+#include "ThumbnailCache.hpp"
+#include "ImageLoader.hpp"
+#include <QtCore/QFileInfo>
+#include <QtGui/QIcon>
+#include <QtGui/QPixmap>
+
+namespace
+{
+    // Room under an icon for the file name, and below for the scroll bar
+    const int LabelHeight = 28;
+    const int ScrollBarHeight = 20;
+}
+
+ThumbnailStrip::ThumbnailStrip(QWidget *parent)
+    : QListWidget(parent), m_cache(new ThumbnailCache(this))
+{
+    setViewMode(QListView::IconMode);
+    setFlow(QListView::LeftToRight);
+    setWrapping(false);
+    setMovement(QListView::Static);
+    setUniformItemSizes(true);
+    setHorizontalScrollMode(QAbstractItemView::ScrollPerPixel);
+    setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+    setIconSize(QSize(ThumbnailCache::Edge, ThumbnailCache::Edge));
+    setGridSize(QSize(ThumbnailCache::Edge + 16, ThumbnailCache::Edge + LabelHeight));
+    setFixedHeight(ThumbnailCache::Edge + LabelHeight + ScrollBarHeight);
+
+    connect(m_cache, &ThumbnailCache::thumbnailReady, this, &ThumbnailStrip::onThumbnailReady);
+    connect(this, &QListWidget::itemClicked, this, [this](QListWidgetItem *item)
+            { emit fileActivated(item->data(Qt::UserRole).toString()); });
+}
+
+void ThumbnailStrip::showFolderOf(const QString &filename)
+{
+    const QFileInfo info(filename);
+    const QString directory = info.absolutePath();
+    if (directory != m_directory || !m_items.contains(info.absoluteFilePath()))
+    {
+        // Also relisted for a file that is new to the folder, e.g. just saved
+        m_directory = directory;
+        m_cache->cancelPending(); // The last folder's thumbnails are not needed now
+        clear();
+        m_items.clear();
+
+        const QStringList files = ImageLoader::imageFiles(directory);
+        const int current = files.indexOf(info.absoluteFilePath());
+        for (int i = 0; i < files.size(); ++i)
+        {
+            QListWidgetItem *item = new QListWidgetItem(QFileInfo(files[i]).fileName(), this);
+            item->setData(Qt::UserRole, files[i]);
+            item->setToolTip(files[i]);
+            m_items.insert(files[i], item);
+
+            // Cached ones show at once; the rest are made nearest first
+            QImage thumbnail = m_cache->request(files[i], current < 0 ? -i : -qAbs(i - current));
+            if (!thumbnail.isNull())
+            {
+                item->setIcon(QIcon(QPixmap::fromImage(thumbnail)));
+            }
+        }
+    }
+
+    // Only a click opens a file, so marking this one does not reopen it
+    QListWidgetItem *item = m_items.value(info.absoluteFilePath());
+    setCurrentItem(item);
+    if (item)
+    {
+        scrollToItem(item, QAbstractItemView::PositionAtCenter);
+    }
+}
+
+void ThumbnailStrip::onThumbnailReady(const QString &filename, const QImage &thumbnail)
+{
+    QListWidgetItem *item = m_items.value(filename);
+    if (item && !thumbnail.isNull())
+    {
+        item->setIcon(QIcon(QPixmap::fromImage(thumbnail)));
+    }
+}
@@ -0,0 +1,367 @@
+#include "TiledImage.hpp"
+#include "RowBands.hpp"
+#include <QtCore/QDir>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QSaveFile>
+#include <QtCore/QStandardPaths>
+#include <QtCore/QtEndian>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+namespace
+{
+    const int BytesPerPixel = 4;
+    const qint64 TileBytes = qint64(TiledImage::TileSize) * TiledImage::TileSize * BytesPerPixel;
+
+    // Rows read at once by band-wise passes over the whole image
+    const qint64 BandBytes = 64ll * 1024 * 1024;
+
+    // Largest side QImage handles at 32 bits per pixel
+    const int MaxImageSide = 32767;
+
+    // Set by TiledImage::setScratchDirectory(), empty for the default
+    QMutex scratchMutex;
+    QString scratchOverride;
+
+    // Averages factor x factor blocks of band (partial ones at the right and
+    // bottom edge) into rows [first, last) of out, starting at outRow
+    void averageBlocks(const QImage &band, int factor, QImage &out, int outRow, int first, int last)
+    {
+        const int outWidth = out.width();
+        std::vector<quint32> sums(static_cast<size_t>(outWidth) * BytesPerPixel);
+        for (int y = first; y < last; ++y)
+        {
+            std::fill(sums.begin(), sums.end(), 0u);
+            const int top = y * factor;
+            const int bottom = qMin(top + factor, band.height());
+            for (int sourceY = top; sourceY < bottom; ++sourceY)
+            {
+                const uchar *in = band.constScanLine(sourceY);
+                for (int x = 0; x < band.width(); ++x)
+                {
+                    quint32 *sum = sums.data() + static_cast<size_t>(x / factor) * BytesPerPixel;
+                    for (int channel = 0; channel < BytesPerPixel; ++channel)
+                    {
+                        sum[channel] += in[x * BytesPerPixel + channel];
+                    }
+                }
+            }
+
+            uchar *target = out.scanLine(outRow + y);
+            const int rows = bottom - top;
+            for (int x = 0; x < outWidth; ++x)
+            {
+                const quint32 count = quint32(rows) * quint32(qMin(factor, band.width() - x * factor));
+                for (int channel = 0; channel < BytesPerPixel; ++channel)
+                {
+                    target[x * BytesPerPixel + channel] = static_cast<uchar>((sums[x * BytesPerPixel + channel] + count / 2) / count);
+                }
+            }
+        }
+    }
+
+    void putLE16(uchar *bytes, quint16 value)
+    {
+        qToLittleEndian(value, bytes);
+    }
+
+    void putLE32(uchar *bytes, quint32 value)
+    {
+        qToLittleEndian(value, bytes);
+    }
+}
+
+TiledImage::TiledImage(const QSize &size, QImage::Format format)
+    : m_size(size), m_format(format), m_mappedBudget(DefaultMappedBudget)
+{
+    const bool supported = format == QImage::Format_RGB32 || format == QImage::Format_ARGB32 || format == QImage::Format_ARGB32_Premultiplied;
+    if (!supported || size.isEmpty())
+    {
+        return;
+    }
+
+    // Scratch space is reserved, not written: most file systems keep it
+    // sparse until tiles are filled in
+    const qint64 tileCount = qint64(tileColumns()) * tileRows();
+    const QString directory = scratchDirectory();
+    QDir().mkpath(directory);
+    m_file.setFileTemplate(QDir(directory).filePath("EZImageManipulator-XXXXXX.tiles"));
+    if (!m_file.open() || !m_file.resize(tileCount * TileBytes))
+    {
+        return;
+    }
+    m_tiles.resize(static_cast<size_t>(tileCount));
+}
+
+TiledImage::~TiledImage()
+{
+    for (int index : m_mapped)
+    {
+        m_file.unmap(m_tiles[index].data);
+    }
+}
+
+bool TiledImage::needsTiling(const QSize &size)
+{
+    return size.width() > MaxImageSide || size.height() > MaxImageSide ||
+           qint64(size.width()) * size.height() * BytesPerPixel > MaxInMemoryBytes;
+}
+
+void TiledImage::setScratchDirectory(const QString &directory)
+{
+    QMutexLocker locker(&scratchMutex);
+    scratchOverride = directory;
+}
+
+QString TiledImage::scratchDirectory()
+{
+    QMutexLocker locker(&scratchMutex);
+    if (!scratchOverride.isEmpty())
+    {
+        return scratchOverride;
+    }
+    return QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).filePath("tiles");
+}
+
+void TiledImage::setMappedBudget(qint64 bytes)
+{
+    QMutexLocker locker(&m_mutex);
+    m_mappedBudget = qMax(TileBytes, bytes);
+}
+
+QRect TiledImage::tileRect(int column, int row) const
+{
+    return QRect(column * TileSize, row * TileSize, TileSize, TileSize).intersected(rect());
+}
+
+uchar *TiledImage::acquire(int index) const
+{
+    QMutexLocker locker(&m_mutex);
+    Tile &tile = m_tiles[index];
+    if (tile.data)
+    {
+        m_mapped.erase(std::find(m_mapped.begin(), m_mapped.end(), index));
+    }
+    else
+    {
+        // Make room by unmapping idle tiles; pinned ones may overshoot the
+        // budget for as long as they are in use
+        auto idle = m_mapped.begin();
+        while (qint64(m_mapped.size() + 1) * TileBytes > m_mappedBudget && idle != m_mapped.end())
+        {
+            if (m_tiles[*idle].pins > 0)
+            {
+                ++idle;
+                continue;
+            }
+            m_file.unmap(m_tiles[*idle].data);
+            m_tiles[*idle].data = nullptr;
+            idle = m_mapped.erase(idle);
+        }
+        tile.data = m_file.map(index * TileBytes, TileBytes);
+        if (!tile.data)
+        {
+            return nullptr;
+        }
+    }
+    m_mapped.push_back(index);
+    ++tile.pins;
+    return tile.data;
+}
+
+void TiledImage::release(int index) const
+{
+    QMutexLocker locker(&m_mutex);
+    --m_tiles[index].pins;
+}
+
+bool TiledImage::copyRect(const QRect &area, uchar *bits, qsizetype bytesPerLine, bool forWrite) const
+{
+    if (isNull() || !rect().contains(area))
+    {
+        return false;
+    }
+    const qsizetype tileStride = qsizetype(TileSize) * BytesPerPixel;
+    const int firstColumn = area.left() / TileSize;
+    const int lastColumn = area.right() / TileSize;
+    const int firstRow = area.top() / TileSize;
+    const int lastRow = area.bottom() / TileSize;
+    for (int row = firstRow; row <= lastRow; ++row)
+    {
+        for (int column = firstColumn; column <= lastColumn; ++column)
+        {
+            const int index = row * tileColumns() + column;
+            uchar *tile = acquire(index);
+            if (!tile)
+            {
+                return false;
+            }
+            const QRect part = tileRect(column, row).intersected(area);
+            const size_t rowBytes = static_cast<size_t>(part.width()) * BytesPerPixel;
+            for (int y = part.top(); y <= part.bottom(); ++y)
+            {
+                uchar *inTile = tile + (y - row * TileSize) * tileStride + (part.left() - column * TileSize) * BytesPerPixel;
+                uchar *outside = bits + (y - area.top()) * bytesPerLine + (part.left() - area.left()) * BytesPerPixel;
+                if (forWrite)
+                {
+                    std::memcpy(inTile, outside, rowBytes);
+                }
+                else
+                {
+                    std::memcpy(outside, inTile, rowBytes);
+                }
+            }
+            release(index);
+        }
+    }
+    return true;
+}
+
+QImage TiledImage::read(const QRect &area) const
+{
+    QImage image(area.size(), m_format);
+    if (image.isNull() || !copyRect(area, image.bits(), image.bytesPerLine(), false))
+    {
+        return QImage();
+    }
+    return image;
+}
+
+bool TiledImage::write(const QImage &image, const QPoint &offset)
+{
+    const QImage source = image.format() == m_format ? image : image.convertToFormat(m_format);
+    // copyRect() only reads from the buffer when writing tiles
+    return !source.isNull() && copyRect(QRect(offset, source.size()), const_cast<uchar *>(source.constBits()), source.bytesPerLine(), true);
+}
+
+QImage TiledImage::reduced(const QRect &area, int factor, int threads) const
+{
+    if (factor < 1 || !rect().contains(area) || area.isEmpty())
+    {
+        return QImage();
+    }
+    const QSize outSize((area.width() + factor - 1) / factor, (area.height() + factor - 1) / factor);
+    QImage out(outSize, m_format);
+    if (out.isNull())
+    {
+        return QImage();
+    }
+
+    // Whole blocks per band, as many output rows as fit into the band budget
+    const qint64 blockRowBytes = qint64(area.width()) * BytesPerPixel * factor;
+    const int outRowsPerBand = static_cast<int>(qBound<qint64>(1, BandBytes / blockRowBytes, outSize.height()));
+    for (int outRow = 0; outRow < outSize.height(); outRow += outRowsPerBand)
+    {
+        const int outRows = qMin(outRowsPerBand, outSize.height() - outRow);
+        const int top = area.top() + outRow * factor;
+        const QImage band = read(QRect(area.left(), top, area.width(), qMin(outRows * factor, area.bottom() + 1 - top)));
+        if (band.isNull())
+        {
+            return QImage();
+        }
+        forEachRowBand(outRows, threads, 1, [&](int begin, int end)
+                       { averageBlocks(band, factor, out, outRow, begin, end); });
+    }
+    return out;
+}
+
+std::unique_ptr<TiledImage> TiledImage::transformed(const QRect &crop, const Orientation &orientation, int threads) const
+{
+    if (!rect().contains(crop) || crop.isEmpty())
+    {
+        return nullptr;
+    }
+    const QSize outSize = orientation.mapSize(crop.size());
+    auto out = std::make_unique<TiledImage>(outSize, m_format);
+    if (out->isNull())
+    {
+        return nullptr;
+    }
+
+    // Each output tile reads the one source region that lands on it, so
+    // only a tile's worth of pixels is in flight per thread
+    const Orientation inverse = orientation.inverted();
+    std::atomic<bool> failed(false);
+    forEachRowBand(out->tileRows(), threads, 1, [&](int begin, int end)
+                   {
+        for (int row = begin; row < end && !failed.load(); ++row)
+        {
+            for (int column = 0; column < out->tileColumns(); ++column)
+            {
+                const QRect target = out->tileRect(column, row);
+                QImage piece = read(inverse.mapRect(target, outSize).translated(crop.topLeft()));
+                if (piece.isNull() || !out->write(orientation.apply(std::move(piece), 1), target.topLeft()))
+                {
+                    failed.store(true);
+                    return;
+                }
+            }
+        } });
+    if (failed.load())
+    {
+        return nullptr;
+    }
+    return out;
+}
+
+bool TiledImage::saveBmp(const QString &filename) const
+{
+    if (isNull())
+    {
+        return false;
+    }
+
+    // Bottom-up rows of BGR, each padded to four bytes. Sizes past the
+    // 32-bit header fields are written as 0, which readers accept for
+    // uncompressed files.
+    const qint64 rowBytes = (qint64(m_size.width()) * 3 + 3) & ~qint64(3);
+    const qint64 pixelBytes = rowBytes * m_size.height();
+    constexpr qint64 headerBytes = 14 + 40;
+    auto field = [](qint64 value)
+    { return value > 0xffffffffll ? 0u : static_cast<quint32>(value); };
+
+    uchar header[headerBytes] = {};
+    header[0] = 'B';
+    header[1] = 'M';
+    putLE32(header + 2, field(headerBytes + pixelBytes));
+    putLE32(header + 10, headerBytes);
+    putLE32(header + 14, 40);
+    putLE32(header + 18, static_cast<quint32>(m_size.width()));
+    putLE32(header + 22, static_cast<quint32>(m_size.height()));
+    putLE16(header + 26, 1);
+    putLE16(header + 28, 24);
+    putLE32(header + 34, field(pixelBytes));
+    putLE32(header + 38, 2835); // 72 dpi
+    putLE32(header + 42, 2835);
+
+    // Replaces the target only once every row is written
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly) || file.write(reinterpret_cast<const char *>(header), headerBytes) != headerBytes)
+    {
+        return false;
+    }
+
+    const int bandRows = static_cast<int>(qBound<qint64>(1, BandBytes / (qint64(m_size.width()) * BytesPerPixel), m_size.height()));
+    QByteArray padded(static_cast<qsizetype>(rowBytes), '\0');
+    for (int bottom = m_size.height(); bottom > 0; bottom -= bandRows)
+    {
+        const int top = qMax(0, bottom - bandRows);
+        const QImage band = read(QRect(0, top, m_size.width(), bottom - top)).convertToFormat(QImage::Format_BGR888);
+        if (band.isNull())
+        {
+            file.cancelWriting();
+            return false;
+        }
+        for (int y = band.height() - 1; y >= 0; --y)
+        {
+            std::memcpy(padded.data(), band.constScanLine(y), static_cast<size_t>(m_size.width()) * 3);
+            if (file.write(padded) != rowBytes)
+            {
+                file.cancelWriting();
+                return false;
+            }
+        }
+    }
+    return file.commit();
+}
@@ -0,0 +1,351 @@
+#include "TiledImageItem.hpp"
+#include "ImagePyramid.hpp"
+#include "Resampler.hpp"
+#include "EditPipeline.hpp"
+#include "TiledImage.hpp"
+#include <QtGui/QPainter>
+#include <QtWidgets/QStyleOptionGraphicsItem>
+#include <QtCore/QList>
+#include <cstring>
+
+namespace
+{
+    // Budget for rasterized tiles, roughly a few 4K screens worth of pixels
+    const int TileCacheBudgetKiB = 256 * 1024;
+
+    // Extra source pixels sampled around each tile so the smoothing filter
+    // sees its neighbours and adjacent tiles blend without seams
+    const int TilePadding = 2;
+
+    // Detail tiles are read from the full-resolution source once a tile
+    // covers at most this many source pixels per side for each of its own,
+    // which bounds what a tile reads; closer to the overview it is magnified
+    const qreal MaxDetailReduction = 4.0;
+}
+
+TiledImageItem::TiledImageItem(QGraphicsItem *parent)
+    : QGraphicsObject(parent), m_pyramid(nullptr), m_tileScale(1.0), m_tileCache(TileCacheBudgetKiB),
+      m_detailGeneration(0), m_detailRequests(0)
+{
+    // Needed for QStyleOptionGraphicsItem::exposedRect to be filled in
+    setFlag(ItemUsesExtendedStyleOption);
+}
+
+TiledImageItem::~TiledImageItem()
+{
+    // Results still queued to this object are discarded with it
+    m_detailPool.clear();
+    m_detailPool.waitForDone();
+}
+
+void TiledImageItem::setImage(const QImage &image, const QRect &dirtyRect)
+{
+    bool sameSize = image.size() == m_image.size();
+    if (sameSize && image.cacheKey() == m_image.cacheKey())
+    {
+        return; // Nothing changed, keep all tiles
+    }
+
+    if (!sameSize)
+    {
+        prepareGeometryChange();
+    }
+    m_image = image;
+
+    if (sameSize && dirtyRect.isValid())
+    {
+        invalidate(dirtyRect);
+    }
+    else
+    {
+        invalidateAll();
+    }
+}
+
+void TiledImageItem::writeRows(const QImage &rows, int firstRow)
+{
+    QRect target = QRect(0, firstRow, rows.width(), rows.height()).intersected(m_image.rect());
+    if (target.isEmpty())
+    {
+        return;
+    }
+
+    QImage source = rows.format() == m_image.format() ? rows : rows.convertToFormat(m_image.format());
+    int rowBytes = qMin(source.bytesPerLine(), m_image.bytesPerLine());
+    for (int y = target.top(); y <= target.bottom(); ++y)
+    {
+        memcpy(m_image.scanLine(y), source.constScanLine(y - firstRow), rowBytes);
+    }
+    invalidate(target);
+}
+
+void TiledImageItem::setDetailSource(const std::shared_ptr<const TiledImage> &source)
+{
+    if (source == m_detail)
+    {
+        return;
+    }
+    m_detail = source;
+    invalidateAll();
+}
+
+void TiledImageItem::setSourceRect(const QRect &rect)
+{
+    if (rect == m_sourceRect)
+    {
+        return;
+    }
+    prepareGeometryChange(); // Tiles stay valid, only the visible part changes
+    m_sourceRect = rect;
+    update();
+}
+
+void TiledImageItem::invalidate(const QRect &imageRect)
+{
+    // Tile footprint in image pixels at the scale the cache was built for
+    qreal footprint = TileSize / m_tileScale;
+    QRect padded = imageRect.adjusted(-TilePadding, -TilePadding, TilePadding, TilePadding);
+
+    const QList<quint64> keys = m_tileCache.keys();
+    for (quint64 key : keys)
+    {
+        int column = static_cast<int>(key & 0xffffffffu);
+        int row = static_cast<int>(key >> 32);
+        QRectF tileRect(column * footprint, row * footprint, footprint, footprint);
+        if (tileRect.intersects(padded))
+        {
+            m_tileCache.remove(key);
+        }
+    }
+    update(padded);
+}
+
+void TiledImageItem::pyramidUpdated(const QRect &imageRect)
+{
+    if (m_tileScale >= 1.0)
+    {
+        return; // 1:1 tiles come straight from the image
+    }
+    if (imageRect.isValid())
+    {
+        invalidate(imageRect);
+    }
+    else
+    {
+        invalidateAll();
+    }
+}
+
+void TiledImageItem::invalidateAll()
+{
+    dropTiles();
+    update();
+}
+
+void TiledImageItem::dropTiles()
+{
+    m_tileCache.clear();
+    m_pendingDetail.clear();
+    m_detailPool.clear();
+    ++m_detailGeneration;
+}
+
+QRectF TiledImageItem::boundingRect() const
+{
+    return QRectF(m_sourceRect.isValid() ? m_sourceRect.intersected(m_image.rect()) : m_image.rect());
+}
+
+void TiledImageItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
+{
+    Q_UNUSED(widget);
+    if (m_image.isNull())
+    {
+        return;
+    }
+
+    // Rasterize at screen resolution when zoomed out; when zoomed in, 1:1
+    // tiles are enough and the painter magnifies them. With a detail
+    // source, 1:1 is that of its pixels once they are close enough to read.
+    qreal levelOfDetail = QStyleOptionGraphicsItem::levelOfDetailFromTransform(painter->worldTransform());
+    qreal scale = qMin<qreal>(1.0, levelOfDetail);
+    if (m_detail && levelOfDetail > 1.0)
+    {
+        qreal detailScale = qreal(m_detail->size().width()) / m_image.width();
+        if (levelOfDetail * MaxDetailReduction >= detailScale)
+        {
+            scale = qMin(levelOfDetail, detailScale);
+        }
+    }
+    if (!qFuzzyCompare(scale, m_tileScale))
+    {
+        dropTiles();
+        m_tileScale = scale;
+    }
+
+    QRectF exposed = option->exposedRect.intersected(boundingRect());
+    if (exposed.isEmpty())
+    {
+        return;
+    }
+
+    if (m_sourceRect.isValid())
+    {
+        painter->setClipRect(boundingRect(), Qt::IntersectClip); // Edge tiles reach past a crop
+    }
+
+    QSize grid = tileGridSize();
+    qreal footprint = TileSize / m_tileScale;
+    int firstColumn = qBound(0, static_cast<int>(exposed.left() / footprint), grid.width() - 1);
+    int lastColumn = qBound(0, static_cast<int>(exposed.right() / footprint), grid.width() - 1);
+    int firstRow = qBound(0, static_cast<int>(exposed.top() / footprint), grid.height() - 1);
+    int lastRow = qBound(0, static_cast<int>(exposed.bottom() / footprint), grid.height() - 1);
+
+    for (int row = firstRow; row <= lastRow; ++row)
+    {
+        for (int column = firstColumn; column <= lastColumn; ++column)
+        {
+            quint64 key = tileKey(column, row);
+            QPixmap tile;
+            if (QPixmap *cached = m_tileCache.object(key))
+            {
+                tile = *cached;
+            }
+            else if (m_detail && m_tileScale > 1.0 && !qFuzzyCompare(m_tileScale, 1.0))
+            {
+                // The overview stands in, magnified, until the tile is read
+                requestDetailTile(column, row);
+                QRectF area = QRectF(column * footprint, row * footprint, footprint, footprint).intersected(QRectF(m_image.rect()));
+                painter->drawImage(area, m_image, area);
+                continue;
+            }
+            else
+            {
+                tile = renderTile(column, row);
+                int costKiB = qMax(1, tile.width() * tile.height() * 4 / 1024);
+                m_tileCache.insert(key, new QPixmap(tile), costKiB);
+            }
+
+            QRectF target(column * footprint, row * footprint, tile.width() / m_tileScale, tile.height() / m_tileScale);
+            painter->drawPixmap(target, tile, QRectF(tile.rect()));
+        }
+    }
+}
+
+QSize TiledImageItem::tileGridSize() const
+{
+    int displayWidth = qMax(1, qRound(m_image.width() * m_tileScale));
+    int displayHeight = qMax(1, qRound(m_image.height() * m_tileScale));
+    return QSize((displayWidth + TileSize - 1) / TileSize, (displayHeight + TileSize - 1) / TileSize);
+}
+
+QRect TiledImageItem::displayTileRect(int column, int row) const
+{
+    QSize displaySize(qMax(1, qRound(m_image.width() * m_tileScale)), qMax(1, qRound(m_image.height() * m_tileScale)));
+    return QRect(column * TileSize, row * TileSize, TileSize, TileSize).intersected(QRect(QPoint(0, 0), displaySize));
+}
+
+QPixmap TiledImageItem::renderTile(int column, int row) const
+{
+    QRect tileRect = displayTileRect(column, row);
+    if (qFuzzyCompare(m_tileScale, 1.0))
+    {
+        return QPixmap::fromImage(EditPipeline::regionView(m_image, tileRect));
+    }
+
+    // Start from the pyramid level just above the tile scale, so only a
+    // small (at most 2:1) resample is left to do
+    qreal levelScale = 1.0;
+    bool usePyramid = m_pyramid && m_pyramid->baseCacheKey() == m_image.cacheKey();
+    QImage source = usePyramid ? m_pyramid->levelForScale(m_tileScale, &levelScale) : m_image;
+    qreal scale = m_tileScale / levelScale;
+
+    // Source region the tile covers, padded and clamped to the level
+    QRect sourceRect = QRectF(tileRect.x() / scale, tileRect.y() / scale,
+                              tileRect.width() / scale, tileRect.height() / scale)
+                           .toAlignedRect()
+                           .adjusted(-TilePadding, -TilePadding, TilePadding, TilePadding)
+                           .intersected(source.rect());
+
+    QSize scaledSize(qMax(1, qRound(sourceRect.width() * scale)), qMax(1, qRound(sourceRect.height() * scale)));
+    // Tiles are small, so one thread each; a 2:1 step needs no wider filter
+    ResampleOptions options;
+    options.filter = ResampleFilter::Bilinear;
+    options.threads = 1;
+    QImage scaled = Resampler::resample(EditPipeline::regionView(source, sourceRect), scaledSize, options);
+
+    QImage tile(tileRect.size(), QImage::Format_ARGB32_Premultiplied);
+    tile.fill(Qt::transparent);
+    QPainter painter(&tile);
+    painter.setRenderHint(QPainter::SmoothPixmapTransform);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.drawImage(QRectF(sourceRect.x() * scale - tileRect.x(),
+                             sourceRect.y() * scale - tileRect.y(),
+                             sourceRect.width() * scale,
+                             sourceRect.height() * scale),
+                      scaled);
+    painter.end();
+    return QPixmap::fromImage(tile);
+}
+
+void TiledImageItem::requestDetailTile(int column, int row)
+{
+    const quint64 key = tileKey(column, row);
+    if (m_pendingDetail.contains(key))
+    {
+        return;
+    }
+    m_pendingDetail.insert(key);
+
+    // Source pixels per tile pixel, at most MaxDetailReduction
+    const qreal stepX = m_detail->size().width() / (m_image.width() * m_tileScale);
+    const qreal stepY = m_detail->size().height() / (m_image.height() * m_tileScale);
+    const QRect tileRect = displayTileRect(column, row);
+    const std::shared_ptr<const TiledImage> detail = m_detail;
+    const int generation = m_detailGeneration;
+    // Higher priorities run first: after a pan, the tiles now in view come
+    // before the ones scrolled past
+    m_detailPool.start([this, detail, tileRect, stepX, stepY, column, row, generation]()
+                       {
+        QImage tile = renderDetailTile(*detail, tileRect, stepX, stepY);
+        QMetaObject::invokeMethod(this, [this, column, row, generation, tile]()
+                                  { detailTileReady(column, row, generation, tile); }, Qt::QueuedConnection); },
+                       ++m_detailRequests);
+}
+
+void TiledImageItem::detailTileReady(int column, int row, int generation, const QImage &tile)
+{
+    if (generation != m_detailGeneration)
+    {
+        return; // Read for a scale or source since replaced
+    }
+    const quint64 key = tileKey(column, row);
+    m_pendingDetail.remove(key);
+    if (tile.isNull())
+    {
+        return;
+    }
+    int costKiB = qMax(1, tile.width() * tile.height() * 4 / 1024);
+    m_tileCache.insert(key, new QPixmap(QPixmap::fromImage(tile)), costKiB);
+
+    qreal footprint = TileSize / m_tileScale;
+    update(QRectF(column * footprint, row * footprint, footprint, footprint));
+}
+
+QImage TiledImageItem::renderDetailTile(const TiledImage &detail, const QRect &tileRect, qreal stepX, qreal stepY)
+{
+    QRect sourceRect = QRectF(tileRect.x() * stepX, tileRect.y() * stepY, tileRect.width() * stepX, tileRect.height() * stepY)
+                           .toAlignedRect()
+                           .intersected(detail.rect());
+
+    // Whole blocks are averaged while reading; a small resample is left
+    int factor = qMax(1, static_cast<int>(qMin(stepX, stepY)));
+    QImage source = factor > 1 ? detail.reduced(sourceRect, factor, 1) : detail.read(sourceRect);
+    if (source.isNull() || source.size() == tileRect.size())
+    {
+        return source;
+    }
+    ResampleOptions options;
+    options.filter = ResampleFilter::Bilinear;
+    options.threads = 1;
+    return Resampler::resample(source, tileRect.size(), options);
+}
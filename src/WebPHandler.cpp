@@ -1,94 +1,281 @@
 #include "WebPHandler.hpp"
+#include "EditPipeline.hpp"
 #include <webp/encode.h>
 #include <webp/decode.h>
 #include <webp/mux.h>
 #include <QtCore/QFile>
+#include <QtCore/QSaveFile>
 #include <QtCore/QBuffer>
 #include <QtCore/QByteArray>
+#include <QtCore/QElapsedTimer>
+#include <utility>
 
-bool WebPHandler::encode(const QImage &image, const QString &filename, int quality)
+namespace
 {
-    int width, height;
-    uint8_t *rgba = convertToRGBA(image, &width, &height);
-    if (!rgba)
-        return false;
+    // Compressed input for a decode. The file is memory-mapped when possible,
+    // so the bitstream is paged in by the OS instead of being copied into a
+    // heap buffer; files that cannot be mapped are read into a buffer.
+    class FileInput
+    {
+    public:
+        explicit FileInput(const QString &filename)
+            : m_file(filename), m_mapped(nullptr)
+        {
+            if (!m_file.open(QIODevice::ReadOnly))
+            {
+                return;
+            }
+            qint64 size = m_file.size();
+            if (size > 0)
+            {
+                m_mapped = m_file.map(0, size);
+            }
+            if (!m_mapped)
+            {
+                m_buffer = m_file.readAll(); // Pipes, some network shares, empty files
+            }
+        }
 
-    // Configure the encoder parameters
-    WebPConfig config;
-    if (!WebPConfigInit(&config))
+        ~FileInput()
+        {
+            if (m_mapped)
+            {
+                m_file.unmap(m_mapped);
+            }
+        }
+
+        const uint8_t *data() const
+        {
+            return m_mapped ? m_mapped : reinterpret_cast<const uint8_t *>(m_buffer.constData());
+        }
+
+        size_t size() const
+        {
+            return m_mapped ? static_cast<size_t>(m_file.size()) : static_cast<size_t>(m_buffer.size());
+        }
+
+    private:
+        QFile m_file;
+        uchar *m_mapped;
+        QByteArray m_buffer;
+    };
+
+    // Decoded pixels go straight into the formats the viewer paints fastest:
+    // premultiplied ARGB32 with alpha, RGB32 (alpha forced to 0xff) without
+    QImage::Format decodedFormat(bool hasAlpha)
     {
-        delete[] rgba;
-        return false;
+        return hasAlpha ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32;
     }
 
-    config.quality = static_cast<float>(quality);
-    config.method = 6; // Highest compression method
+    // libwebp byte order matching decodedFormat() in memory
+    WEBP_CSP_MODE decodedMode(bool hasAlpha)
+    {
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+        return hasAlpha ? MODE_bgrA : MODE_BGRA;
+#else
+        return hasAlpha ? MODE_Argb : MODE_ARGB;
+#endif
+    }
 
-    if (!WebPValidateConfig(&config))
+    // Imports the pixels into pic straight from the QImage's own buffer with
+    // its real stride. Only formats libwebp cannot read directly (premultiplied,
+    // indexed, grayscale, high bit depth, ...) are converted first.
+    bool importPicture(const QImage &image, WebPPicture *pic)
     {
-        delete[] rgba;
-        return false;
+        pic->width = image.width();
+        pic->height = image.height();
+        pic->use_argb = 1;
+
+        const int stride = static_cast<int>(image.bytesPerLine());
+        switch (image.format())
+        {
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+        case QImage::Format_RGB32:
+            return WebPPictureImportBGRX(pic, image.constBits(), stride);
+        case QImage::Format_ARGB32:
+            return WebPPictureImportBGRA(pic, image.constBits(), stride);
+#endif
+        case QImage::Format_RGBX8888:
+            return WebPPictureImportRGBX(pic, image.constBits(), stride);
+        case QImage::Format_RGBA8888:
+            return WebPPictureImportRGBA(pic, image.constBits(), stride);
+        case QImage::Format_RGB888:
+            return WebPPictureImportRGB(pic, image.constBits(), stride);
+        case QImage::Format_BGR888:
+            return WebPPictureImportBGR(pic, image.constBits(), stride);
+        default:
+            break;
+        }
+
+        // libwebp wants straight alpha in byte order; RGBA8888 is that on any host
+        QImage converted = image.convertToFormat(image.hasAlphaChannel() ? QImage::Format_RGBA8888 : QImage::Format_RGBX8888);
+        if (converted.isNull())
+        {
+            return false;
+        }
+        return importPicture(converted, pic);
     }
 
-    // Set up the input picture
-    WebPPicture pic;
-    if (!WebPPictureInit(&pic))
+    // Per-encode state passed through WebPPicture::custom_ptr
+    struct DeviceWriter
     {
-        delete[] rgba;
-        return false;
+        QIODevice *device;
+        qint64 bytesWritten;
+        const std::function<bool(int)> *progress;
+    };
+
+    // WebPWriterFunction streaming encoded chunks straight to the device
+    int writeToDevice(const uint8_t *data, size_t dataSize, const WebPPicture *picture)
+    {
+        DeviceWriter *writer = static_cast<DeviceWriter *>(picture->custom_ptr);
+        qint64 size = static_cast<qint64>(dataSize);
+        if (writer->device->write(reinterpret_cast<const char *>(data), size) != size)
+        {
+            return 0;
+        }
+        writer->bytesWritten += size;
+        return 1;
     }
 
-    pic.width = width;
-    pic.height = height;
-    pic.use_argb = 1;
+    // WebPProgressHook forwarding to WebPEncodeOptions::progress; returning 0
+    // makes WebPEncode() stop with VP8_ENC_ERROR_USER_ABORT
+    int reportProgress(int percent, const WebPPicture *picture)
+    {
+        const DeviceWriter *writer = static_cast<const DeviceWriter *>(picture->custom_ptr);
+        return (*writer->progress)(percent) ? 1 : 0;
+    }
 
-    if (!WebPPictureImportRGBA(&pic, rgba, width * 4))
+    // Speed/size trade-off of each profile. All of them let libwebp use
+    // its extra threads (thread_level) for analysis and filtering.
+    bool configureProfile(WebPConfig *config, const WebPEncodeOptions &options)
     {
-        delete[] rgba;
-        WebPPictureFree(&pic);
-        return false;
+        config->thread_level = 1;
+        switch (options.profile)
+        {
+        case WebPEncodeProfile::Fast:
+            config->quality = static_cast<float>(options.quality);
+            config->method = 1;
+            config->pass = 1;
+            config->segments = 2;
+            break;
+        case WebPEncodeProfile::Balanced:
+            config->quality = static_cast<float>(options.quality);
+            config->method = 4;
+            config->pass = 1;
+            config->segments = 4;
+            break;
+        case WebPEncodeProfile::MaxCompression:
+            config->quality = static_cast<float>(options.quality);
+            config->method = 6; // Highest compression method
+            config->pass = 6;
+            config->segments = 4;
+            break;
+        case WebPEncodeProfile::Lossless:
+            // Sets lossless, method and quality (effort) for a mid-level preset
+            if (!WebPConfigLosslessPreset(config, 6))
+            {
+                return false;
+            }
+            config->thread_level = 1;
+            break;
+        }
+        return WebPValidateConfig(config) != 0;
     }
+}
 
-    delete[] rgba; // We can delete the input buffer now
+bool WebPHandler::encode(const QImage &image, const QString &filename, const WebPEncodeOptions &options, WebPEncodeStats *stats)
+{
+    if (options.atomicWrite)
+    {
+        // Written to a temporary file and renamed over filename only on success
+        QSaveFile file(filename);
+        if (!file.open(QIODevice::WriteOnly))
+        {
+            return false;
+        }
+        if (!encode(image, &file, options, stats))
+        {
+            file.cancelWriting();
+            return false;
+        }
+        return file.commit();
+    }
 
-    // Set up the output
     QFile file(filename);
     if (!file.open(QIODevice::WriteOnly))
+    {
+        return false;
+    }
+    if (!encode(image, &file, options, stats))
+    {
+        file.remove(); // Don't leave a truncated file behind
+        return false;
+    }
+    return true;
+}
+
+bool WebPHandler::encode(const QImage &image, QIODevice *device, const WebPEncodeOptions &options, WebPEncodeStats *stats)
+{
+    if (image.isNull() || !device)
+        return false;
+
+    // Configure the encoder parameters
+    WebPConfig config;
+    if (!WebPConfigInit(&config) || !configureProfile(&config, options))
+    {
+        return false;
+    }
+
+    // Set up the input picture
+    WebPPicture pic;
+    if (!WebPPictureInit(&pic))
+    {
+        return false;
+    }
+
+    if (!importPicture(image, &pic))
     {
         WebPPictureFree(&pic);
         return false;
     }
 
-    WebPMemoryWriter writer;
-    WebPMemoryWriterInit(&writer);
-    pic.writer = WebPMemoryWrite;
+    // Encoded chunks go to the device as soon as libwebp produces them
+    DeviceWriter writer = {device, 0, &options.progress};
+    pic.writer = writeToDevice;
     pic.custom_ptr = &writer;
+    if (options.progress)
+    {
+        pic.progress_hook = reportProgress;
+    }
 
     // Encode the image
+    QElapsedTimer timer;
+    timer.start();
     bool success = WebPEncode(&config, &pic);
     WebPPictureFree(&pic);
 
-    if (success)
+    if (stats)
     {
-        file.write(reinterpret_cast<char *>(writer.mem), writer.size);
-        file.close();
+        stats->encodeMs = timer.elapsed();
+        stats->outputBytes = writer.bytesWritten;
+        stats->profile = options.profile;
     }
-
-    WebPMemoryWriterClear(&writer);
     return success;
 }
 
 QImage WebPHandler::decode(const QString &filename)
 {
-    QFile file(filename);
-    if (!file.open(QIODevice::ReadOnly))
+    return decode(filename, DecodeOptions());
+}
+
+QImage WebPHandler::decode(const QString &filename, const DecodeOptions &options)
+{
+    FileInput input(filename);
+    if (input.size() == 0)
     {
         return QImage();
     }
 
-    QByteArray data = file.readAll();
-    file.close();
-
     // Initialize decoder
     WebPDecoderConfig config;
     if (!WebPInitDecoderConfig(&config))
@@ -97,77 +284,148 @@ QImage WebPHandler::decode(const QString &filename)
     }
 
     // Get features from the WebP file
-    VP8StatusCode status = WebPGetFeatures(
-        reinterpret_cast<const uint8_t *>(data.constData()),
-        data.size(),
-        &config.input);
+    VP8StatusCode status = WebPGetFeatures(input.data(), input.size(), &config.input);
     if (status != VP8_STATUS_OK)
     {
         return QImage();
     }
 
-    // Set up output buffer format
-    config.output.colorspace = MODE_RGBA;
-    config.output.is_external_memory = 0;
-
-    // Decode the WebP file
-    status = WebPDecode(
-        reinterpret_cast<const uint8_t *>(data.constData()),
-        data.size(),
-        &config);
-    if (status != VP8_STATUS_OK)
+    const QRect canvas(0, 0, config.input.width, config.input.height);
+    const QRect region = options.region.isValid() ? options.region.intersected(canvas) : canvas;
+    if (region.isEmpty())
     {
         return QImage();
     }
+    const bool scaled = options.size.isValid() && !options.size.isEmpty() && options.size != region.size();
 
-    // Get the decoded data
-    uint8_t *rgba = config.output.u.RGBA.rgba;
+    // Lossy data is cropped from the even pixel at or before the region
+    QRect decoded = region;
+    if (region != canvas)
+    {
+        decoded.setLeft(region.left() & ~1);
+        decoded.setTop(region.top() & ~1);
+        config.options.use_cropping = 1;
+        config.options.crop_left = decoded.left();
+        config.options.crop_top = decoded.top();
+        config.options.crop_width = decoded.width();
+        config.options.crop_height = decoded.height();
+    }
+    const QSize outputSize = scaled ? options.size : decoded.size();
+    if (scaled)
+    {
+        config.options.use_scaling = 1;
+        config.options.scaled_width = outputSize.width();
+        config.options.scaled_height = outputSize.height();
+    }
 
-    if (!rgba)
+    // Decode straight into the QImage buffer, no intermediate copy
+    bool hasAlpha = config.input.has_alpha != 0;
+    QImage result(outputSize, decodedFormat(hasAlpha));
+    if (result.isNull())
     {
-        WebPFreeDecBuffer(&config.output);
         return QImage();
     }
+    config.output.colorspace = decodedMode(hasAlpha);
+    config.output.is_external_memory = 1;
+    config.output.u.RGBA.rgba = result.bits();
+    config.output.u.RGBA.stride = result.bytesPerLine();
+    config.output.u.RGBA.size = static_cast<size_t>(result.sizeInBytes());
 
-    QImage result = convertFromRGBA(
-        rgba,
-        config.output.width,
-        config.output.height,
-        config.input.has_alpha != 0);
-
-    WebPFreeDecBuffer(&config.output);
+    // Decode the WebP file
+    status = WebPDecode(input.data(), input.size(), &config);
+    if (status != VP8_STATUS_OK)
+    {
+        return QImage();
+    }
+    if (!scaled && decoded != region)
+    {
+        return EditPipeline::regionView(std::move(result), region.translated(-decoded.topLeft()));
+    }
     return result;
 }
 
-uint8_t *WebPHandler::convertToRGBA(const QImage &image, int *width, int *height)
+QSize WebPHandler::imageSize(const QString &filename)
 {
-    // Convert to RGBA8888 format if needed
-    QImage converted;
-    if (image.format() != QImage::Format_RGBA8888)
+    FileInput input(filename);
+    int width = 0;
+    int height = 0;
+    if (input.size() == 0 || !WebPGetInfo(input.data(), input.size(), &width, &height))
     {
-        converted = image.convertToFormat(QImage::Format_RGBA8888);
+        return QSize();
     }
-    else
+    return QSize(width, height);
+}
+
+QImage WebPHandler::decodeIncremental(const QString &filename, const DecodeProgressCallback &progress, int chunkSize)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly))
     {
-        converted = image;
+        return QImage();
     }
+    const qint64 totalBytes = file.size();
 
-    *width = converted.width();
-    *height = converted.height();
+    // Read until the headers tell us the canvas size
+    QByteArray data;
+    WebPBitstreamFeatures features;
+    VP8StatusCode status = VP8_STATUS_NOT_ENOUGH_DATA;
+    while (status == VP8_STATUS_NOT_ENOUGH_DATA)
+    {
+        QByteArray chunk = file.read(chunkSize);
+        if (chunk.isEmpty())
+        {
+            return QImage();
+        }
+        data.append(chunk);
+        status = WebPGetFeatures(reinterpret_cast<const uint8_t *>(data.constData()), data.size(), &features);
+    }
+    if (status != VP8_STATUS_OK)
+    {
+        return QImage();
+    }
 
-    // Allocate and copy the image data
-    size_t bufferSize = (*width) * (*height) * 4;
-    uint8_t *rgba = new uint8_t[bufferSize];
-    memcpy(rgba, converted.constBits(), bufferSize);
+    // Rows are decoded straight into the image buffer
+    bool hasAlpha = features.has_alpha != 0;
+    QImage image(features.width, features.height, decodedFormat(hasAlpha));
+    if (image.isNull())
+    {
+        return QImage();
+    }
+    WebPIDecoder *idec = WebPINewRGB(decodedMode(hasAlpha), image.bits(), static_cast<size_t>(image.sizeInBytes()), image.bytesPerLine());
+    if (!idec)
+    {
+        return QImage();
+    }
 
-    return rgba;
-}
+    qint64 bytesRead = 0;
+    int decodedRows = 0;
+    bool success = false;
+    while (!data.isEmpty())
+    {
+        status = WebPIAppend(idec, reinterpret_cast<const uint8_t *>(data.constData()), data.size());
+        bytesRead += data.size();
+        if (status != VP8_STATUS_OK && status != VP8_STATUS_SUSPENDED)
+        {
+            break; // Corrupt bitstream
+        }
 
-QImage WebPHandler::convertFromRGBA(const uint8_t *data, int width, int height, bool hasAlpha)
-{
-    QImage::Format format = QImage::Format_RGBA8888;
-    int bytesPerLine = width * 4;
+        int lastRow = decodedRows;
+        if (WebPIDecGetRGB(idec, &lastRow, nullptr, nullptr, nullptr))
+        {
+            decodedRows = lastRow;
+        }
+        if (progress && !progress(image, decodedRows, bytesRead, totalBytes))
+        {
+            break; // Aborted by the caller
+        }
+        if (status == VP8_STATUS_OK)
+        {
+            success = true;
+            break;
+        }
+        data = file.read(chunkSize); // Empty at EOF, i.e. a truncated file
+    }
 
-    QImage image(data, width, height, bytesPerLine, format);
-    return image.copy(); // Create a deep copy as the data pointer will be freed
+    WebPIDelete(idec);
+    return success ? image : QImage();
 }
@@ -49,8 +49,7 @@ void ZoomTool::zoomIn()
         return;
     qreal currentZoomFactor = m_editor->getZoomFactor();
     currentZoomFactor = qMin(5.0f, currentZoomFactor * 1.2f);
-    m_editor->setZoomFactor(currentZoomFactor); // Assuming ImageEditor has setZoomFactor
-    m_editor->updateDisplay();
+    m_editor->setZoomFactor(currentZoomFactor); // Only changes the view transform
 }
 
 void ZoomTool::zoomOut()
@@ -59,30 +58,27 @@ void ZoomTool::zoomOut()
         return;
     qreal currentZoomFactor = m_editor->getZoomFactor();
     currentZoomFactor = qMax(0.1f, currentZoomFactor / 1.2f);
-    m_editor->setZoomFactor(currentZoomFactor); // Assuming ImageEditor has setZoomFactor
-    m_editor->updateDisplay();
+    m_editor->setZoomFactor(currentZoomFactor); // Only changes the view transform
 }
 
 void ZoomTool::zoomFit()
 {
-    if (!m_editor || m_editor->getCurrentImage().isNull())
+    if (!m_editor || !m_editor->hasImage())
     {
         return;
     }
 
     // Calculate zoom factor to fit the image within the view
-    qreal hScale = static_cast<qreal>(m_editor->getGraphicsView()->viewport()->width()) / m_editor->getCurrentImage().width();   // Assuming getGraphicsView()
-    qreal vScale = static_cast<qreal>(m_editor->getGraphicsView()->viewport()->height()) / m_editor->getCurrentImage().height(); // Assuming getGraphicsView()
-    m_editor->setZoomFactor(qMin(hScale, vScale));                                                                               // Assuming ImageEditor has setZoomFactor
-    m_editor->updateDisplay();
+    qreal hScale = static_cast<qreal>(m_editor->getGraphicsView()->viewport()->width()) / m_editor->getCurrentSize().width();   // Assuming getGraphicsView()
+    qreal vScale = static_cast<qreal>(m_editor->getGraphicsView()->viewport()->height()) / m_editor->getCurrentSize().height(); // Assuming getGraphicsView()
+    m_editor->setZoomFactor(qMin(hScale, vScale));
 }
 
 void ZoomTool::zoom100()
 {
     if (!m_editor)
         return;
-    m_editor->setZoomFactor(1.0f); // Assuming ImageEditor has setZoomFactor
-    m_editor->updateDisplay();
+    m_editor->setZoomFactor(1.0f);
 }
 
 void ZoomTool::resetZoom()
@@ -90,5 +86,4 @@ void ZoomTool::resetZoom()
     if (!m_editor)
         return;
     m_editor->setZoomFactor(1.0f); // This is now effectively 100% zoom
-    m_editor->updateDisplay();
 }
\ No newline at end of file
@@ -1,8 +1,33 @@
 #include <QtWidgets/QApplication>
+#include <QtCore/QCoreApplication>
+#include <QtGui/QImageReader>
+#include <cstring>
 #include "ImageEditor.hpp"
+#include "BatchProcessor.hpp"
+#include "Benchmark.hpp"
 
 int main(int argc, char *argv[])
 {
+    // Qt refuses to decode past 256 MiB by default. Sizes are checked
+    // against TiledImage::needsTiling() before decoding instead, and a
+    // tiled import without region decoding has to decode the whole image.
+    QImageReader::setAllocationLimit(0);
+
+    // Headless mode must not create a QApplication, which needs a display
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--batch") == 0)
+        {
+            QCoreApplication app(argc, argv);
+            return BatchProcessor::exec(app.arguments());
+        }
+        if (std::strcmp(argv[i], "--benchmark") == 0)
+        {
+            QCoreApplication app(argc, argv);
+            return Benchmark::exec(app.arguments());
+        }
+    }
+
     QApplication app(argc, argv);
 
     ImageEditor editor;